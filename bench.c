@@ -0,0 +1,246 @@
+#define PHYSICS_HEADLESS
+#define CATCH_OBJECT_OVERFLOW
+#define MAX_MOBJ_COUNT 100000
+#define MAX_SOBJ_COUNT 4096
+#define MAX_CONTACT_PAIRS 16384
+#define USE_CONTACT_EVENTS
+#ifdef BENCH_PROFILE
+#define USE_PROFILER
+#endif
+#define NO_DEFAULT_SIMULATION
+#include "physics.h"
+#include <stdio.h>
+
+// headless benchmark, prints one JSON array of results to stdout
+// usage: bench [object counts...], defaults to 10 100 1000
+// every scene is built deterministically so results compare across runs
+// make bench builds it four ways, with and without USE_BLOCKMAP and BENCH_PROFILE,
+// every result says which blockmap setting it ran with
+// plain builds time ticks without the profiler's timers in them, BENCH_PROFILE builds
+// run the same cases again with the profiler for the per tick counts and the phase breakdown
+// and leave out the timings, which the profiler itself skews
+
+// each case runs at least MIN_TICKS ticks and keeps going until MIN_SECONDS have passed,
+// but never past MAX_SECONDS, a case whose first tick alone is expected to take longer than
+// that going by the scene's last size is skipped, the mobj pairs grow with the square of the count
+#define MIN_TICKS 3
+#define MAX_TICKS 1000
+#define MIN_SECONDS 0.5
+#define MAX_SECONDS 10.0
+// the size timed for the estimate when a scene has no smaller size to go by
+#define CALIBRATION_COUNT 100
+
+#ifdef USE_BLOCKMAP
+#define BENCH_BLOCKMAP "true"
+#else
+#define BENCH_BLOCKMAP "false"
+#endif
+
+collider_t box(double half_width, double half_height) {
+    return make_collider(4,
+        -half_width, -half_height,
+        -half_width, half_height,
+        half_width, half_height,
+        half_width, -half_height
+    );
+}
+
+void add_box(simulation_t *simulation, double x, double y, double size, vector_t velocity) {
+    simulation_add_mobj(simulation, (mobj_t){
+        .position = {x, y},
+        .velocity = velocity,
+        .collider = box(size/2, size/2),
+        .material = {.bounciness = 0.5},
+        .mass = 1
+    });
+}
+
+void add_wall(simulation_t *simulation, double x, double y, double half_width, double half_height, double angle) {
+    simulation_add_sobj(simulation, (sobj_t){
+        .position = {x, y},
+        .collider = rotate(box(half_width, half_height), angle),
+        .material = {.bounciness = 0.5}
+    });
+}
+
+// boxes stacked in a pyramid resting just above the ground
+void scene_pyramid(simulation_t *simulation, int count) {
+    int rows = 1, row, column, added = 0;
+    while(rows*(rows+1)/2 < count) {
+        ++rows;
+    }
+    add_wall(simulation, 0, 10, rows*12+100, 10, 0);
+    for(row=0; row<rows && added<count; ++row) {
+        for(column=0; column<rows-row && added<count; ++column, ++added) {
+            add_box(simulation, (column - (rows-row)/2.0)*22, -11 - row*22, 20, zero_vector);
+        }
+    }
+}
+
+// a grid of boxes falling into a V of two sloped walls
+void scene_rain_funnel(simulation_t *simulation, int count) {
+    int columns = (int)sqrt(count) + 1, i;
+    double width = columns*30;
+    add_wall(simulation, -width/2, 0, width/2, 5, -M_PI/8);
+    add_wall(simulation, width/2, 0, width/2, 5, M_PI/8);
+    for(i=0; i<count; ++i) {
+        add_box(simulation, (i%columns - columns/2.0)*30, -200 - (i/columns)*30, 16, zero_vector);
+    }
+}
+
+// boxes packed edge to edge inside a container
+void scene_pile(simulation_t *simulation, int count) {
+    int columns = (int)sqrt(count) + 1, i;
+    double width = columns*11;
+    add_wall(simulation, 0, 10, width/2+20, 10, 0);
+    add_wall(simulation, -width/2-10, -width/2, 10, width/2+20, 0);
+    add_wall(simulation, width/2+10, -width/2, 10, width/2+20, 0);
+    for(i=0; i<count; ++i) {
+        add_box(simulation, (i%columns - columns/2.0)*11 + 5, -6 - (i/columns)*11, 10, zero_vector);
+    }
+}
+
+// small fast boxes fired at a wall
+void scene_bullet_hail(simulation_t *simulation, int count) {
+    int i;
+    add_wall(simulation, 1000, 0, 20, count*2+100, 0);
+    for(i=0; i<count; ++i) {
+        add_box(simulation, -(i%50)*20, (i/50)*8 - count*2, 4, (vector_t){40, 0});
+    }
+}
+
+// bodies and walls spread thinly over a large area
+// a wall for every four bodies, as many as MAX_SOBJ_COUNT allows
+void scene_sparse(simulation_t *simulation, int count) {
+    int columns = (int)sqrt(count) + 1, walls = count/4+1, i;
+    unsigned int seed = 1;
+    if(walls > MAX_SOBJ_COUNT) {
+        walls = MAX_SOBJ_COUNT;
+    }
+    for(i=0; i<walls; ++i) {
+        seed = seed*1103515245 + 12345;
+        add_wall(simulation, (i%columns)*2000.0, (i/columns)*2000.0 + 400, 100, 10, (seed>>16)%628/100.0);
+    }
+    for(i=0; i<count; ++i) {
+        add_box(simulation, (i%columns)*500.0, (i/columns)*500.0, 20, (vector_t){1, 0});
+    }
+}
+
+typedef struct scene_s {
+    const char *name;
+    void (*build)(simulation_t *simulation, int count);
+} scene_t;
+
+const scene_t scenes[] = {
+    {"pyramid", scene_pyramid},
+    {"rain_funnel", scene_rain_funnel},
+    {"pile", scene_pile},
+    {"bullet_hail", scene_bullet_hail},
+    {"sparse", scene_sparse}
+};
+
+// counts begin and persist events, which is one per touching pair per tick
+bool count_contacts(const contact_event_t *event, void *data) {
+    if(event->type != CONTACT_END) {
+        ++*(long long *)data;
+    }
+    return false;
+}
+
+// nanoseconds for one tick of scene at count objects, not reported
+double calibrate(simulation_t *simulation, const scene_t *scene, int count) {
+    simulation_init(simulation);
+    scene->build(simulation, count);
+    Uint64 start = SDL_GetPerformanceCounter();
+    tick(simulation);
+    return (double)(SDL_GetPerformanceCounter()-start) * 1e9 / SDL_GetPerformanceFrequency();
+}
+
+int main(int argc, char **argv) {
+    int default_counts[] = {10, 100, 1000};
+    int count_total = argc > 1 ? argc-1 : 3;
+    int c, s, count;
+    bool first = true;
+    // per scene, the last count that ran and its time per tick
+    int last_count[sizeof(scenes)/sizeof(scenes[0])] = {0};
+    double last_ns[sizeof(scenes)/sizeof(scenes[0])] = {0};
+    simulation_t *simulation = malloc(sizeof(simulation_t));
+    if(!simulation) {
+        fprintf(stderr, "failed to allocate simulation\n");
+        return 1;
+    }
+
+    printf("[\n");
+    for(c=0; c<count_total; ++c) {
+        count = argc > 1 ? atoi(argv[c+1]) : default_counts[c];
+        for(s=0; s<(int)(sizeof(scenes)/sizeof(scenes[0])); ++s) {
+            if(!last_count[s] && count > CALIBRATION_COUNT) {
+                last_ns[s] = calibrate(simulation, &scenes[s], CALIBRATION_COUNT);
+                last_count[s] = CALIBRATION_COUNT;
+            }
+            double estimate = last_count[s] ? last_ns[s] * ((double)count/last_count[s]) * ((double)count/last_count[s]) : 0;
+            if(estimate > MAX_SECONDS*1e9) {
+                printf("%s  {\"scene\": \"%s\", \"objects\": %d, \"skipped\": true, \"estimated_ns_per_tick\": %.0f}",
+                       first ? "" : ",\n", scenes[s].name, count, estimate);
+                fflush(stdout);
+                first = false;
+                continue;
+            }
+            simulation_init(simulation);
+            scenes[s].build(simulation, count);
+            // CATCH_OBJECT_OVERFLOW drops adds past the caps, a scene missing objects would time the wrong thing
+            if(simulation->mobj_count != count) {
+                fprintf(stderr, "%s got %d of %d objects, MAX_MOBJ_COUNT is %d\n",
+                        scenes[s].name, simulation->mobj_count, count, MAX_MOBJ_COUNT);
+                return 1;
+            }
+            long long contacts = 0;
+            simulation->contact_filter = count_contacts;
+            simulation->contact_filter_data = &contacts;
+
+#ifdef BENCH_PROFILE
+            // counts are summed from the profiler's stats for each finished tick
+            tick_counts_t counts = {0};
+#endif
+            int ticks = 0;
+            Uint64 start = SDL_GetPerformanceCounter();
+            double seconds = 0;
+            while(ticks < MAX_TICKS && seconds < MAX_SECONDS && (ticks < MIN_TICKS || seconds < MIN_SECONDS)) {
+                tick(simulation);
+                ++ticks;
+                seconds = (double)(SDL_GetPerformanceCounter()-start) / SDL_GetPerformanceFrequency();
+#ifdef BENCH_PROFILE
+                counts.pairs += simulation->stats.counts.pairs;
+                counts.narrowphase_tests += simulation->stats.counts.narrowphase_tests;
+                counts.hits += simulation->stats.counts.hits;
+                counts.line_tests += simulation->stats.counts.line_tests;
+#endif
+            }
+            last_count[s] = count;
+            last_ns[s] = seconds*1e9/ticks;
+
+            printf("%s  {\"scene\": \"%s\", \"blockmap\": %s, \"objects\": %d, \"mobjs\": %d, \"sobjs\": %d, \"ticks\": %d, ",
+                   first ? "" : ",\n", scenes[s].name, BENCH_BLOCKMAP, count, simulation->mobj_count, simulation->sobj_count, ticks);
+#ifdef BENCH_PROFILE
+            printf("\"pairs_per_tick\": %.0f, \"narrowphase_tests_per_tick\": %.0f, "
+                   "\"hits_per_tick\": %.2f, \"line_tests_per_tick\": %.0f, \"contacts_per_tick\": %.2f, \"phase_ms\": {",
+                   (double)counts.pairs/ticks, (double)counts.narrowphase_tests/ticks,
+                   (double)counts.hits/ticks, (double)counts.line_tests/ticks, (double)contacts/ticks);
+            int p;
+            for(p=0; p<PHASE_COUNT; ++p) {
+                printf("%s\"%s\": %.4f", p ? ", " : "", tick_phase_names[p], simulation->stats.phases[p].average);
+            }
+            printf("}}");
+#else
+            printf("\"ns_per_tick\": %.0f, \"ticks_per_second\": %.2f, \"contacts_per_tick\": %.2f}",
+                   seconds*1e9/ticks, ticks/seconds, (double)contacts/ticks);
+#endif
+            fflush(stdout);
+            first = false;
+        }
+    }
+    printf("\n]\n");
+
+    free(simulation);
+    return 0;
+}
@@ -1,11 +1,192 @@
 #pragma once
 
+// PHYSICS_HEADLESS builds the simulation without SDL, for servers
+// render() and begin_loop() are left out, step with tick() or simulation_step()
+#if defined(PHYSICS_HEADLESS) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+#if (defined(PHYSICS_HEADLESS) || defined(USE_PERF_COUNTERS)) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+
 #include <stdbool.h>
-#include <SDL2/SDL.h>
-#include <time.h>
 #include <math.h>
 #include <stdarg.h>
 
+#ifdef PHYSICS_HEADLESS
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#else
+#include <SDL2/SDL.h>
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#if defined(PHYSICS_HEADLESS) && !defined(SDL_h_)
+// the handful of SDL primitives the simulation uses, on top of POSIX
+// they're defined as physics_shim_* and the SDL names are macros for them, so nothing
+// here clashes with SDL when it's linked in, a file that also uses SDL includes SDL.h first
+// and then gets the real thing
+// physics_shim_atomic_t keeps SDL_atomic_t's layout so saved state matches between builds
+typedef uint8_t Uint8;
+typedef uint32_t Uint32;
+typedef int32_t Sint32;
+typedef uint64_t Uint64;
+typedef int64_t Sint64;
+
+#define SDL_malloc malloc
+#define SDL_realloc realloc
+#define SDL_free free
+#define SDL_memcpy memcpy
+#define SDL_memmove memmove
+#define SDL_memcmp memcmp
+#define SDL_memset memset
+#define SDL_GetError() "headless"
+
+#define SDL_atomic_t physics_shim_atomic_t
+#define SDL_AtomicGet physics_shim_atomic_get
+#define SDL_AtomicSet physics_shim_atomic_set
+#define SDL_AtomicAdd physics_shim_atomic_add
+#define SDL_AtomicCAS physics_shim_atomic_cas
+#define SDL_AtomicGetPtr physics_shim_atomic_get_ptr
+#define SDL_AtomicSetPtr physics_shim_atomic_set_ptr
+#define SDL_GetPerformanceCounter physics_shim_performance_counter
+#define SDL_GetPerformanceFrequency physics_shim_performance_frequency
+#define SDL_Delay physics_shim_delay
+#define SDL_GetCPUCount physics_shim_cpu_count
+#define SDL_ThreadFunction physics_shim_thread_function_t
+#define SDL_Thread physics_shim_thread_t
+#define SDL_CreateThread physics_shim_create_thread
+#define SDL_WaitThread physics_shim_wait_thread
+#define SDL_sem physics_shim_sem_t
+#define SDL_CreateSemaphore physics_shim_create_semaphore
+#define SDL_SemWait physics_shim_sem_wait
+#define SDL_SemPost physics_shim_sem_post
+#define SDL_DestroySemaphore physics_shim_destroy_semaphore
+
+typedef struct physics_shim_atomic_s {
+    int value;
+} physics_shim_atomic_t;
+
+int physics_shim_atomic_get(physics_shim_atomic_t *a) {
+    return __atomic_load_n(&a->value, __ATOMIC_SEQ_CST);
+}
+
+int physics_shim_atomic_set(physics_shim_atomic_t *a, int v) {
+    return __atomic_exchange_n(&a->value, v, __ATOMIC_SEQ_CST);
+}
+
+int physics_shim_atomic_add(physics_shim_atomic_t *a, int v) {
+    return __atomic_fetch_add(&a->value, v, __ATOMIC_SEQ_CST);
+}
+
+bool physics_shim_atomic_cas(physics_shim_atomic_t *a, int oldval, int newval) {
+    return __atomic_compare_exchange_n(&a->value, &oldval, newval, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+void *physics_shim_atomic_get_ptr(void **a) {
+    return __atomic_load_n(a, __ATOMIC_SEQ_CST);
+}
+
+void *physics_shim_atomic_set_ptr(void **a, void *v) {
+    return __atomic_exchange_n(a, v, __ATOMIC_SEQ_CST);
+}
+
+#define SDL_MemoryBarrierRelease() __atomic_thread_fence(__ATOMIC_RELEASE)
+#define SDL_MemoryBarrierAcquire() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+
+Uint64 physics_shim_performance_counter(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (Uint64)now.tv_sec*1000000000 + now.tv_nsec;
+}
+
+Uint64 physics_shim_performance_frequency(void) {
+    return 1000000000;
+}
+
+void physics_shim_delay(Uint32 ms) {
+    struct timespec duration = {ms/1000, (long)(ms%1000)*1000000};
+    while(nanosleep(&duration, &duration) != 0);
+}
+
+int physics_shim_cpu_count(void) {
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)count : 1;
+}
+
+typedef int (*physics_shim_thread_function_t)(void *data);
+
+typedef struct physics_shim_thread_s {
+    pthread_t thread;
+    physics_shim_thread_function_t function;
+    void *data;
+    int status;
+} physics_shim_thread_t;
+
+void *physics_shim_run_thread(void *data) {
+    physics_shim_thread_t *thread = data;
+    thread->status = thread->function(thread->data);
+    return NULL;
+}
+
+// threads aren't named without SDL
+physics_shim_thread_t *physics_shim_create_thread(physics_shim_thread_function_t function, const char *name, void *data) {
+    physics_shim_thread_t *thread = malloc(sizeof(physics_shim_thread_t));
+    (void)name;
+    if(!thread) {
+        return NULL;
+    }
+    thread->function = function;
+    thread->data = data;
+    if(pthread_create(&thread->thread, NULL, physics_shim_run_thread, thread) != 0) {
+        free(thread);
+        return NULL;
+    }
+    return thread;
+}
+
+void physics_shim_wait_thread(physics_shim_thread_t *thread, int *status) {
+    pthread_join(thread->thread, NULL);
+    if(status) {
+        *status = thread->status;
+    }
+    free(thread);
+}
+
+typedef sem_t physics_shim_sem_t;
+
+physics_shim_sem_t *physics_shim_create_semaphore(Uint32 value) {
+    physics_shim_sem_t *sem = malloc(sizeof(physics_shim_sem_t));
+    if(sem && sem_init(sem, 0, value) != 0) {
+        free(sem);
+        return NULL;
+    }
+    return sem;
+}
+
+int physics_shim_sem_wait(physics_shim_sem_t *sem) {
+    while(sem_wait(sem) != 0);
+    return 0;
+}
+
+int physics_shim_sem_post(physics_shim_sem_t *sem) {
+    return sem_post(sem);
+}
+
+void physics_shim_destroy_semaphore(physics_shim_sem_t *sem) {
+    sem_destroy(sem);
+    free(sem);
+}
+#endif
+
 #ifdef DEBUG
 #define VERBOSE
 #define DEBUG_SHOW_LAST_COLLISION
@@ -33,13 +214,195 @@
 #define SIMULATION_STEPS 32
 #endif
 
-#if defined(USE_BLOCKMAP) || defined(BLOCKMAP_SIZE) || defined(BLOCKMAP_COUNT)
+// simulation_predict stops once a tick moves the body less than this and leaves it
+// slower than this per tick, spinning in place doesn't count as moving
+#ifndef PREDICT_REST_DISTANCE
+#define PREDICT_REST_DISTANCE 0.01
+#endif
+
+// NO_DEFAULT_SIMULATION leaves out default_simulation, a constant as large as simulation_t,
+// for builds with object counts big enough for that to matter, use simulation_init instead
+
+#if defined(USE_BLOCKMAP) || defined(BLOCKMAP_SIZE) || defined(BLOCKMAP_COUNT) || defined(BLOCKMAP_ENTRIES)
+# ifndef USE_BLOCKMAP
+# define USE_BLOCKMAP
+# endif
 # ifndef BLOCKMAP_SIZE
 # define BLOCKMAP_SIZE 128
 # endif
 # ifndef BLOCKMAP_COUNT
 # define BLOCKMAP_COUNT 128
 # endif
+// total sobj cell memberships, a sobj counts once for every cell it touches
+# ifndef BLOCKMAP_ENTRIES
+# define BLOCKMAP_ENTRIES (MAX_SOBJ_COUNT*16)
+# endif
+#endif
+
+#if defined(USE_BATCH) || defined(BATCH_MAX_THREADS)
+# ifndef USE_BATCH
+# define USE_BATCH
+# endif
+# ifndef BATCH_MAX_THREADS
+# define BATCH_MAX_THREADS 64
+# endif
+#endif
+
+#if defined(USE_COMMAND_QUEUE) || defined(COMMAND_QUEUE_SIZE)
+# ifndef USE_COMMAND_QUEUE
+# define USE_COMMAND_QUEUE
+# endif
+// must be a power of two
+# ifndef COMMAND_QUEUE_SIZE
+# define COMMAND_QUEUE_SIZE 128
+# endif
+#endif
+
+#if defined(USE_CONTACT_EVENTS) || defined(CONTACT_EVENT_BUFFER_SIZE) || defined(MAX_CONTACT_PAIRS)
+# ifndef USE_CONTACT_EVENTS
+# define USE_CONTACT_EVENTS
+# endif
+// must be a power of two
+# ifndef CONTACT_EVENT_BUFFER_SIZE
+# define CONTACT_EVENT_BUFFER_SIZE 256
+# endif
+// contacts tracked per tick, extra contacts are not reported
+# ifndef MAX_CONTACT_PAIRS
+# define MAX_CONTACT_PAIRS 128
+# endif
+#endif
+
+// USE_TRACE records tick, substep, phase and batch job spans for chrome://tracing or Perfetto
+// it builds on the profiler's phase timers, phases show as per tick totals under pid 2
+#if defined(USE_TRACE) || defined(TRACE_BUFFER_EVENTS) || defined(TRACE_MAX_THREADS)
+# ifndef USE_TRACE
+# define USE_TRACE
+# endif
+# ifndef USE_PROFILER
+# define USE_PROFILER
+# endif
+// per thread, must be a power of two
+# ifndef TRACE_BUFFER_EVENTS
+# define TRACE_BUFFER_EVENTS 65536
+# endif
+# ifndef TRACE_MAX_THREADS
+# define TRACE_MAX_THREADS 64
+# endif
+#endif
+
+// USE_PERF_COUNTERS adds hardware counters for each whole tick to the profiler's stats, Linux only
+// they aren't split between phases, tick runs every phase for one mobj before moving on to the
+// next, so phases have no boundaries short of a counter read per mobj per phase, and each read
+// is a read() system call that costs more than most mobjs spend in a phase
+// the counter group is read once at the start and once at the end of a tick instead
+// where perf_event_open is missing or refused the counters read as zero
+// and tick_stats_t.perf_available stays false
+#ifdef USE_PERF_COUNTERS
+# ifndef USE_PROFILER
+# define USE_PROFILER
+# endif
+#endif
+
+// USE_TICK_HISTOGRAM records every tick's duration into simulation->tick_histogram
+// buckets are log spaced with HISTOGRAM_SUB_BITS bits of precision per power of two,
+// 5 bits is about 3% relative error
+#if defined(USE_TICK_HISTOGRAM) || defined(HISTOGRAM_SUB_BITS)
+# ifndef USE_TICK_HISTOGRAM
+# define USE_TICK_HISTOGRAM
+# endif
+# ifndef HISTOGRAM_SUB_BITS
+# define HISTOGRAM_SUB_BITS 5
+# endif
+// values are nanoseconds, anything past 2^40 (about 18 minutes) lands in the last bucket
+# define HISTOGRAM_MAX_BITS 40
+# define HISTOGRAM_BUCKETS ((2 << HISTOGRAM_SUB_BITS) + (HISTOGRAM_MAX_BITS-HISTOGRAM_SUB_BITS) * (1 << HISTOGRAM_SUB_BITS))
+#endif
+
+// USE_SCENE_FILES adds scene_load and scene_compile
+#ifdef USE_SCENE_FILES
+# ifndef USE_SAVE_FILES
+# define USE_SAVE_FILES
+# endif
+# ifndef SCENE_MAX_SHAPES
+# define SCENE_MAX_SHAPES 256
+# endif
+# ifndef SCENE_MAX_MATERIALS
+# define SCENE_MAX_MATERIALS 64
+# endif
+# define SCENE_NAME_LENGTH 32
+# define SCENE_LINE_LENGTH 1024
+#endif
+
+// USE_SAVE_FILES adds simulation_save, simulation_load, level_save and level_load
+#ifdef USE_SAVE_FILES
+# ifndef USE_MAPPED_FILES
+# define USE_MAPPED_FILES
+# endif
+#endif
+
+// USE_REPLAY adds replay_recorder_t, which streams every tick's mobj states to a file
+#if defined(USE_REPLAY) || defined(REPLAY_KEYFRAME_INTERVAL)
+# ifndef USE_REPLAY
+# define USE_REPLAY
+# endif
+# ifndef USE_MAPPED_FILES
+# define USE_MAPPED_FILES
+# endif
+// ticks between full copies of the mobjs, every other tick only stores what changed
+# ifndef REPLAY_KEYFRAME_INTERVAL
+# define REPLAY_KEYFRAME_INTERVAL 600
+# endif
+// encoded ticks are handed to the writer thread a buffer at a time
+# ifndef REPLAY_BUFFER_SIZE
+# define REPLAY_BUFFER_SIZE 65536
+# endif
+# ifndef REPLAY_BUFFERS
+# define REPLAY_BUFFERS 4
+# endif
+// quantization steps are the reciprocals, 1/256 of a unit of position and so on
+# ifndef REPLAY_POSITION_SCALE
+# define REPLAY_POSITION_SCALE 256.0
+# endif
+# ifndef REPLAY_VELOCITY_SCALE
+# define REPLAY_VELOCITY_SCALE 4096.0
+# endif
+# ifndef REPLAY_ANGLE_SCALE
+# define REPLAY_ANGLE_SCALE 65536.0
+# endif
+# ifndef REPLAY_ANGULAR_VELOCITY_SCALE
+# define REPLAY_ANGULAR_VELOCITY_SCALE 1048576.0
+# endif
+#endif
+
+// USE_ROLLBACK adds rollback_t, a ring of compact per tick state captures
+// rollback_init takes how many ticks back the ring reaches, ROLLBACK_FRAMES is a default
+// for callers without their own, 8 ticks is about 130ms at 60 ticks per second
+#if defined(USE_ROLLBACK) || defined(ROLLBACK_FRAMES)
+# ifndef USE_ROLLBACK
+# define USE_ROLLBACK
+# endif
+# ifndef ROLLBACK_FRAMES
+# define ROLLBACK_FRAMES 8
+# endif
+#endif
+
+// begin_loop drops accumulated time past this many ticks in one frame
+// instead of falling further behind trying to catch up
+#ifndef MAX_TICKS_PER_FRAME
+#define MAX_TICKS_PER_FRAME 5
+#endif
+
+// records every contact and candidate pair for the last DEBUG_CAPTURE_TICKS ticks
+#if defined(DEBUG_CAPTURE_TICKS) || defined(DEBUG_CAPTURE_CONTACTS) || defined(DEBUG_CAPTURE_PAIRS)
+# ifndef DEBUG_CAPTURE_TICKS
+# define DEBUG_CAPTURE_TICKS 8
+# endif
+# ifndef DEBUG_CAPTURE_CONTACTS
+# define DEBUG_CAPTURE_CONTACTS 64
+# endif
+# ifndef DEBUG_CAPTURE_PAIRS
+# define DEBUG_CAPTURE_PAIRS 256
+# endif
 #endif
 
 double sqr(double x) {
@@ -66,326 +429,4408 @@ vector_t vector_sub(vector_t vec1, vector_t vec2) {
     };
 }
 
-vector_t vector_multiply(vector_t vec, double scale) {
-    return (vector_t) {
-        .x = vec.x * scale,
-        .y = vec.y * scale
-    };
-}
+vector_t vector_multiply(vector_t vec, double scale) {
+    return (vector_t) {
+        .x = vec.x * scale,
+        .y = vec.y * scale
+    };
+}
+
+double vector_distance_squared(vector_t vec1, vector_t vec2) {
+    return sqr(vec1.x - vec2.x) + sqr(vec1.y - vec2.y);
+}
+
+double vector_distance(vector_t vec1, vector_t vec2) {
+    return sqrt(vector_distance_squared(vec1, vec2));
+}
+
+double vector_magnitude(vector_t vec) {
+    return sqrt(sqr(vec.x) + sqr(vec.y));
+}
+
+vector_t vector_normalize(vector_t vec) {
+    return vector_multiply(vec, 1.0 / vector_magnitude(vec));
+}
+
+double vector_dot(vector_t vec1, vector_t vec2) {
+    return vec1.x * vec2.x + vec1.y * vec2.y;
+}
+
+double vector_cross_z(vector_t vec1, vector_t vec2) {
+    return (vec1.x*vec2.y) - (vec1.y*vec2.x);
+}
+
+vector_t vector_lerp(vector_t from, vector_t to, double t) {
+    return vector_add(from, vector_multiply(vector_sub(to, from), t));
+}
+
+vector_t vector_proj(vector_t onto, vector_t from) {
+    return vector_multiply(onto, vector_dot(onto, from)
+           / sqr(vector_magnitude(onto)));
+}
+
+#ifdef USE_TRACE
+#include <stdio.h>
+
+// a complete span, name must be a string literal
+// totals are summed phase times rather than real spans and go on their own track
+typedef struct trace_event_s {
+    const char *name;
+    Uint64 start, end;
+    bool total;
+} trace_event_t;
+
+// single producer, single consumer ring
+// the owning thread appends, the trace writer thread drains
+// dropped counts events lost to a full ring, dropped_written is how many of those the
+// writer has reported so far
+typedef struct trace_buffer_s {
+    trace_event_t events[TRACE_BUFFER_EVENTS];
+    SDL_atomic_t head, tail;
+    int thread;
+    SDL_atomic_t dropped;
+    int dropped_written;
+} trace_buffer_t;
+
+typedef struct trace_s {
+    // trace_buffer_t pointers, published with SDL_AtomicSetPtr once the buffer is set up,
+    // a slot claimed through buffer_count can still be NULL for a moment
+    void *buffers[TRACE_MAX_THREADS];
+    SDL_atomic_t buffer_count;
+    SDL_atomic_t running;
+    SDL_Thread *writer;
+    FILE *file;
+    Uint64 origin;
+    bool first;
+} trace_t;
+
+trace_t trace;
+_Thread_local trace_buffer_t *trace_local;
+
+// returns NULL if this thread can't get a buffer
+// the buffer is allocated before a slot is claimed so a failed allocation doesn't use one up
+trace_buffer_t *trace_thread_buffer(void) {
+    if(trace_local) {
+        return trace_local;
+    }
+    trace_buffer_t *buffer = SDL_malloc(sizeof(trace_buffer_t));
+    if(!buffer) {
+        return NULL;
+    }
+    int index = SDL_AtomicAdd(&trace.buffer_count, 1);
+    if(index >= TRACE_MAX_THREADS) {
+        SDL_AtomicAdd(&trace.buffer_count, -1);
+        SDL_free(buffer);
+        return NULL;
+    }
+    SDL_AtomicSet(&buffer->head, 0);
+    SDL_AtomicSet(&buffer->tail, 0);
+    buffer->thread = index;
+    SDL_AtomicSet(&buffer->dropped, 0);
+    buffer->dropped_written = 0;
+    SDL_AtomicSetPtr(&trace.buffers[index], buffer);
+    return trace_local = buffer;
+}
+
+// drops the event instead of waiting if the buffer is full
+void trace_push(const char *name, Uint64 start, Uint64 end, bool total) {
+    if(!SDL_AtomicGet(&trace.running)) {
+        return;
+    }
+    trace_buffer_t *buffer = trace_thread_buffer();
+    if(!buffer) {
+        return;
+    }
+    unsigned int head = SDL_AtomicGet(&buffer->head);
+    if(head - (unsigned int)SDL_AtomicGet(&buffer->tail) == TRACE_BUFFER_EVENTS) {
+        SDL_AtomicAdd(&buffer->dropped, 1);
+        return;
+    }
+    buffer->events[head & (TRACE_BUFFER_EVENTS-1)] = (trace_event_t){name, start, end, total};
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&buffer->head, head+1);
+}
+
+void trace_event(const char *name, Uint64 start, Uint64 end) {
+    trace_push(name, start, end, false);
+}
+
+// writes out everything recorded so far, only called from the writer thread or trace_stop
+// events a full ring dropped show as a "dropped events" counter on the thread's track
+void trace_flush(void) {
+    double frequency = SDL_GetPerformanceFrequency() / 1000000.0;
+    int i, dropped, count = SDL_AtomicGet(&trace.buffer_count);
+    unsigned int tail, head;
+    trace_buffer_t *buffer;
+    trace_event_t *event;
+    for(i=0; i<count && i<TRACE_MAX_THREADS; ++i) {
+        if(!(buffer = SDL_AtomicGetPtr(&trace.buffers[i]))) {
+            continue;
+        }
+        head = SDL_AtomicGet(&buffer->head);
+        SDL_MemoryBarrierAcquire();
+        for(tail=SDL_AtomicGet(&buffer->tail); tail != head; ++tail) {
+            event = &buffer->events[tail & (TRACE_BUFFER_EVENTS-1)];
+            fprintf(trace.file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                    trace.first ? "" : ",\n", event->name, event->total ? 2 : 1, buffer->thread,
+                    (event->start - trace.origin) / frequency, (event->end - event->start) / frequency);
+            trace.first = false;
+        }
+        SDL_MemoryBarrierRelease();
+        SDL_AtomicSet(&buffer->tail, head);
+        dropped = SDL_AtomicGet(&buffer->dropped);
+        if(dropped != buffer->dropped_written) {
+            fprintf(trace.file, "%s{\"name\":\"dropped events\",\"ph\":\"C\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,"
+                    "\"args\":{\"dropped\":%d}}",
+                    trace.first ? "" : ",\n", buffer->thread,
+                    (SDL_GetPerformanceCounter() - trace.origin) / frequency, dropped);
+            trace.first = false;
+            buffer->dropped_written = dropped;
+        }
+    }
+    fflush(trace.file);
+}
+
+int trace_writer(void *data) {
+    (void)data;
+    while(SDL_AtomicGet(&trace.running)) {
+        SDL_Delay(10);
+        trace_flush();
+    }
+    return 0;
+}
+
+// starts recording into a chrome trace event json file, -1 if a trace is already running
+int trace_start(const char *path) {
+    if(trace.writer) {
+        return -1;
+    }
+    trace.file = fopen(path, "w");
+    if(!trace.file) {
+#ifdef VERBOSE
+        printf("failed to open trace file %s\n", path);
+#endif
+        return -1;
+    }
+    fprintf(trace.file, "[\n");
+    trace.first = true;
+    trace.origin = SDL_GetPerformanceCounter();
+    SDL_AtomicSet(&trace.running, 1);
+    trace.writer = SDL_CreateThread(trace_writer, "trace writer", NULL);
+    if(!trace.writer) {
+        SDL_AtomicSet(&trace.running, 0);
+        fclose(trace.file);
+        trace.file = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+// thread buffers are kept for the next trace_start, does nothing if no trace is running
+void trace_stop(void) {
+    if(!trace.writer) {
+        return;
+    }
+    SDL_AtomicSet(&trace.running, 0);
+    SDL_WaitThread(trace.writer, NULL);
+    trace.writer = NULL;
+    trace_flush();
+    fprintf(trace.file, "\n]\n");
+    fclose(trace.file);
+    trace.file = NULL;
+}
+
+#define TRACE_BEGIN(span) Uint64 trace_start_##span = SDL_GetPerformanceCounter()
+#define TRACE_END(span, name) trace_event(name, trace_start_##span, SDL_GetPerformanceCounter())
+#else
+#define TRACE_BEGIN(span)
+#define TRACE_END(span, name)
+#endif
+
+#ifdef USE_PERF_COUNTERS
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+typedef enum perf_counter_e {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_L1D_MISSES,
+    PERF_LLC_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_COUNTER_COUNT
+} perf_counter_t;
+
+const char *const perf_counter_names[PERF_COUNTER_COUNT] = {
+    "cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses"
+};
+
+// counters are per thread, opened the first time a thread ticks and closed by perf_close_thread
+// perf_state is 0 before trying, 1 when open and -1 when unavailable
+// perf_slots maps the group read order back to perf_counter_t, some counters may be missing
+_Thread_local int perf_state;
+_Thread_local int perf_leader = -1;
+_Thread_local int perf_slots[PERF_COUNTER_COUNT], perf_fds[PERF_COUNTER_COUNT], perf_slot_count;
+_Thread_local Uint64 perf_last[PERF_COUNTER_COUNT];
+
+#ifdef __linux__
+int perf_open_counter(Uint32 type, Uint64 config, int group) {
+    struct perf_event_attr attr = {0};
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = group == -1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    return (int)syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+}
+#endif
+
+void perf_open_thread(void) {
+    perf_state = -1;
+#ifdef __linux__
+    const Uint32 types[PERF_COUNTER_COUNT] = {
+        PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE, PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE
+    };
+    const Uint64 configs[PERF_COUNTER_COUNT] = {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16,
+        PERF_COUNT_HW_CACHE_LL | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16,
+        PERF_COUNT_HW_BRANCH_MISSES
+    };
+    int i, fd;
+    perf_slot_count = 0;
+    for(i=0; i<PERF_COUNTER_COUNT; ++i) {
+        fd = perf_open_counter(types[i], configs[i], perf_leader);
+        if(fd < 0) {
+            if(i == PERF_CYCLES) {
+#ifdef VERBOSE
+                printf("hardware performance counters unavailable\n");
+#endif
+                return;
+            }
+            continue;
+        }
+        if(perf_leader == -1) {
+            perf_leader = fd;
+        }
+        perf_fds[perf_slot_count] = fd;
+        perf_slots[perf_slot_count++] = i;
+    }
+    ioctl(perf_leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(perf_leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    perf_state = 1;
+#endif
+}
+
+// call before a thread that ticked exits, the calling thread's counters are closed at process exit
+void perf_close_thread(void) {
+#ifdef __linux__
+    int i;
+    if(perf_state > 0) {
+        for(i=0; i<perf_slot_count; ++i) {
+            close(perf_fds[i]);
+        }
+    }
+#endif
+    perf_leader = -1;
+    perf_state = 0;
+}
+
+// returns false if this thread has no counters
+bool perf_read(Uint64 values[PERF_COUNTER_COUNT]) {
+    if(perf_state == 0) {
+        perf_open_thread();
+    }
+    if(perf_state < 0) {
+        return false;
+    }
+#ifdef __linux__
+    Uint64 group[1+PERF_COUNTER_COUNT];
+    int i;
+    if(read(perf_leader, group, sizeof(group)) < (ssize_t)((1+perf_slot_count) * sizeof(Uint64))) {
+        return false;
+    }
+    for(i=0; i<PERF_COUNTER_COUNT; ++i) {
+        values[i] = 0;
+    }
+    for(i=0; i<perf_slot_count; ++i) {
+        values[perf_slots[i]] = group[1+i];
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+#endif
+
+#ifdef USE_PROFILER
+#include <stdio.h>
+
+typedef enum tick_phase_e {
+    PHASE_COMMANDS,
+    PHASE_INTEGRATE,
+    PHASE_ROTATE,
+    PHASE_MOBJ_COLLISIONS,
+    PHASE_SOBJ_COLLISIONS,
+    PHASE_FORCES,
+    PHASE_EVENTS,
+    PHASE_COUNT
+} tick_phase_t;
+
+const char *const tick_phase_names[PHASE_COUNT] = {
+    "commands", "integrate", "rotate", "mobj_collisions", "sobj_collisions", "forces", "events"
+};
+
+// milliseconds
+typedef struct timer_stats_s {
+    double last, average, max;
+} timer_stats_t;
+
+typedef struct tick_counts_s {
+    long long pairs, narrowphase_tests, hits, line_tests;
+} tick_counts_t;
+
+// counts holds the last complete tick, current the one in progress
+// perf holds the last complete tick's hardware counters, perf_total every tick's
+typedef struct tick_stats_s {
+    Uint64 tick_count;
+    timer_stats_t tick, phases[PHASE_COUNT];
+    Uint64 phase_elapsed[PHASE_COUNT];
+    tick_counts_t counts, current;
+#ifdef USE_PERF_COUNTERS
+    bool perf_available;
+    Uint64 perf[PERF_COUNTER_COUNT], perf_total[PERF_COUNTER_COUNT];
+#endif
+} tick_stats_t;
+
+// lines_collide calls made by collides() on this thread
+_Thread_local long long profile_line_tests;
+
+void timer_stats_add(timer_stats_t *stats, double ms, Uint64 count) {
+    stats->last = ms;
+    stats->average += (ms - stats->average) / count;
+    stats->max = ms > stats->max ? ms : stats->max;
+}
+
+// charges the time since *mark to phase and moves the mark to now
+void profile_lap(tick_stats_t *stats, tick_phase_t phase, Uint64 *mark) {
+    Uint64 now = SDL_GetPerformanceCounter();
+    stats->phase_elapsed[phase] += now - *mark;
+    *mark = now;
+}
+
+void tick_stats_end(tick_stats_t *stats, Uint64 tick_start, long long line_tests) {
+    double frequency = SDL_GetPerformanceFrequency() / 1000.0;
+    Uint64 now = SDL_GetPerformanceCounter();
+    int i;
+#ifdef USE_TRACE
+    // phases interleave per mobj, so each is traced once as its total for the tick,
+    // laid end to end from the tick's start on the totals track rather than where the time was spent
+    Uint64 phase_start = tick_start;
+    trace_event("tick", tick_start, now);
+#endif
+    ++stats->tick_count;
+    timer_stats_add(&stats->tick, (now - tick_start) / frequency, stats->tick_count);
+    for(i=0; i<PHASE_COUNT; ++i) {
+        timer_stats_add(&stats->phases[i], stats->phase_elapsed[i] / frequency, stats->tick_count);
+#ifdef USE_TRACE
+        trace_push(tick_phase_names[i], phase_start, phase_start + stats->phase_elapsed[i], true);
+        phase_start += stats->phase_elapsed[i];
+#endif
+        stats->phase_elapsed[i] = 0;
+    }
+    stats->current.line_tests = line_tests;
+    stats->counts = stats->current;
+    stats->current = (tick_counts_t){0};
+#ifdef USE_PERF_COUNTERS
+    Uint64 values[PERF_COUNTER_COUNT];
+    stats->perf_available = perf_read(values);
+    if(stats->perf_available) {
+        for(i=0; i<PERF_COUNTER_COUNT; ++i) {
+            stats->perf[i] = values[i] - perf_last[i];
+            stats->perf_total[i] += stats->perf[i];
+        }
+    }
+#endif
+}
+
+void tick_stats_reset(tick_stats_t *stats) {
+    *stats = (tick_stats_t){0};
+}
+
+void tick_stats_print(const tick_stats_t *stats, FILE *file) {
+    int i;
+    fprintf(file, "%-16s %10s %10s %10s\n", "phase (ms)", "last", "average", "max");
+    fprintf(file, "%-16s %10.4f %10.4f %10.4f\n", "tick", stats->tick.last, stats->tick.average, stats->tick.max);
+    for(i=0; i<PHASE_COUNT; ++i) {
+        fprintf(file, "%-16s %10.4f %10.4f %10.4f\n", tick_phase_names[i],
+                stats->phases[i].last, stats->phases[i].average, stats->phases[i].max);
+    }
+    fprintf(file, "pairs %lld, narrowphase tests %lld, hits %lld, line tests %lld\n",
+            stats->counts.pairs, stats->counts.narrowphase_tests, stats->counts.hits, stats->counts.line_tests);
+#ifdef USE_PERF_COUNTERS
+    int j;
+    if(!stats->perf_available) {
+        fprintf(file, "hardware counters unavailable\n");
+        return;
+    }
+    fprintf(file, "%-16s", "counters");
+    for(j=0; j<PERF_COUNTER_COUNT; ++j) {
+        fprintf(file, " %14s", perf_counter_names[j]);
+    }
+    fprintf(file, " %6s\n", "ipc");
+    fprintf(file, "%-16s", "tick (total)");
+    for(j=0; j<PERF_COUNTER_COUNT; ++j) {
+        fprintf(file, " %14llu", (unsigned long long)stats->perf_total[j]);
+    }
+    fprintf(file, " %6.2f\n", stats->perf_total[PERF_CYCLES]
+            ? (double)stats->perf_total[PERF_INSTRUCTIONS] / stats->perf_total[PERF_CYCLES] : 0);
+#endif
+}
+
+#ifdef USE_PERF_COUNTERS
+#define PROFILE_START() \
+    Uint64 profile_tick_start = SDL_GetPerformanceCounter(), profile_mark = profile_tick_start; \
+    long long profile_line_tests_start = profile_line_tests; \
+    perf_read(perf_last)
+#else
+#define PROFILE_START() \
+    Uint64 profile_tick_start = SDL_GetPerformanceCounter(), profile_mark = profile_tick_start; \
+    long long profile_line_tests_start = profile_line_tests
+#endif
+#define PROFILE_LAP(simulation, phase) profile_lap(&(simulation)->stats, phase, &profile_mark)
+#define PROFILE_COUNT(simulation, counter) ++(simulation)->stats.current.counter
+#define PROFILE_END(simulation) \
+    tick_stats_end(&(simulation)->stats, profile_tick_start, profile_line_tests - profile_line_tests_start)
+#define PROFILE_LINE_TEST() ++profile_line_tests
+#else
+#define PROFILE_START()
+#define PROFILE_LAP(simulation, phase)
+#define PROFILE_COUNT(simulation, counter)
+#define PROFILE_END(simulation)
+#define PROFILE_LINE_TEST()
+#endif
+
+#ifdef USE_TICK_HISTOGRAM
+#include <stdio.h>
+
+typedef struct histogram_s {
+    Uint64 counts[HISTOGRAM_BUCKETS];
+    Uint64 total, min, max;
+} histogram_t;
+
+// values below 2^(HISTOGRAM_SUB_BITS+1) get a bucket each,
+// above that every power of two is split into 2^HISTOGRAM_SUB_BITS buckets
+int histogram_bucket(Uint64 value) {
+    if(value < (2 << HISTOGRAM_SUB_BITS)) {
+        return (int)value;
+    }
+    int shift = 0;
+    while((value >> shift) >= (2 << HISTOGRAM_SUB_BITS)) {
+        ++shift;
+    }
+    int bucket = (2 << HISTOGRAM_SUB_BITS) + (shift-1) * (1 << HISTOGRAM_SUB_BITS)
+               + (int)(value >> shift) - (1 << HISTOGRAM_SUB_BITS);
+    return bucket < HISTOGRAM_BUCKETS ? bucket : HISTOGRAM_BUCKETS-1;
+}
+
+// largest value that lands in bucket
+Uint64 histogram_bucket_limit(int bucket) {
+    if(bucket < (2 << HISTOGRAM_SUB_BITS)) {
+        return bucket;
+    }
+    int shift = (bucket - (2 << HISTOGRAM_SUB_BITS)) / (1 << HISTOGRAM_SUB_BITS) + 1;
+    Uint64 sub = (bucket - (2 << HISTOGRAM_SUB_BITS)) % (1 << HISTOGRAM_SUB_BITS) + (1 << HISTOGRAM_SUB_BITS);
+    return ((sub+1) << shift) - 1;
+}
+
+void histogram_record(histogram_t *histogram, Uint64 value) {
+    ++histogram->counts[histogram_bucket(value)];
+    if(histogram->total == 0 || value < histogram->min) {
+        histogram->min = value;
+    }
+    if(value > histogram->max) {
+        histogram->max = value;
+    }
+    ++histogram->total;
+}
+
+void histogram_reset(histogram_t *histogram) {
+    *histogram = (histogram_t){0};
+}
+
+// percentile is 0 to 100, returns the upper limit of the bucket it falls in
+// so the result is never below the true value
+Uint64 histogram_percentile(const histogram_t *histogram, double percentile) {
+    if(histogram->total == 0) {
+        return 0;
+    }
+    Uint64 rank = (Uint64)ceil(percentile / 100 * histogram->total), seen = 0;
+    int i;
+    rank = rank < 1 ? 1 : rank;
+    for(i=0; i<HISTOGRAM_BUCKETS; ++i) {
+        seen += histogram->counts[i];
+        if(seen >= rank) {
+            Uint64 limit = histogram_bucket_limit(i);
+            return limit < histogram->max ? limit : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+// percentiles then every non empty bucket with its cumulative share, values in microseconds
+void histogram_print(const histogram_t *histogram, FILE *file) {
+    const double percentiles[] = {50, 90, 99, 99.9, 99.99};
+    Uint64 seen = 0;
+    int i;
+    fprintf(file, "count %llu, min %.3f, max %.3f\n", (unsigned long long)histogram->total,
+            histogram->min / 1000.0, histogram->max / 1000.0);
+    for(i=0; i<(int)(sizeof(percentiles)/sizeof(percentiles[0])); ++i) {
+        fprintf(file, "p%-6g %12.3f\n", percentiles[i], histogram_percentile(histogram, percentiles[i]) / 1000.0);
+    }
+    for(i=0; i<HISTOGRAM_BUCKETS; ++i) {
+        if(histogram->counts[i]) {
+            seen += histogram->counts[i];
+            fprintf(file, "<= %12.3f %10llu %8.4f%%\n", histogram_bucket_limit(i) / 1000.0,
+                    (unsigned long long)histogram->counts[i], 100.0 * seen / histogram->total);
+        }
+    }
+}
+#endif
+
+// VERTICES ARE COUNTER CLOCKWISE
+typedef struct collider_s {
+    vector_t vertices[MAX_COLLIDER_VERTICES];
+    int vertex_count;
+} collider_t;
+
+// ensure minimum 3 vertices
+// ensure varargs have a decimal point, (double) cast, or suffix
+// to explicitly tell the compiler they are doubles
+collider_t make_collider(int vertex_count, ...) {
+    collider_t collider;
+    collider.vertex_count = vertex_count;
+    va_list args;
+    va_start(args, vertex_count);
+    int i;
+    for(i=0; i < vertex_count; ++i) {
+        collider.vertices[i] = (vector_t){
+            .x = va_arg(args, double),
+            .y = va_arg(args, double)
+        };
+    }
+    va_end(args);
+    return collider;
+}
+
+collider_t rotate(collider_t original, double angle) {
+    collider_t result = {
+        .vertex_count = original.vertex_count
+    };
+    int i;
+    if(angle ==0) {
+        for(i=0; i<original.vertex_count; ++i) {
+            result.vertices[i] = original.vertices[i];
+        }
+        return result;
+    }
+
+    angle = 2*M_PI-angle;
+    for(i=0; i<original.vertex_count; ++i) {
+        result.vertices[i].x = original.vertices[i].x * cos(angle) - original.vertices[i].y * sin(angle);
+        result.vertices[i].y = original.vertices[i].x * sin(angle) + original.vertices[i].y * cos(angle);
+    }
+
+    return result;
+}
+
+typedef struct line_s {
+    vector_t start, end;
+} line_t;
+
+bool lines_collide(line_t l1, line_t l2, vector_t *collision_point) {
+    double uA = ((l2.end.x-l2.start.x)*(l1.start.y-l2.start.y) - (l2.end.y-l2.start.y)*(l1.start.x-l2.start.x))
+              / ((l2.end.y-l2.start.y)*(l1.end.x-l1.start.x) - (l2.end.x-l2.start.x)*(l1.end.y-l1.start.y));
+    double uB = ((l1.end.x-l1.start.x)*(l1.start.y-l2.start.y) - (l1.end.y-l1.start.y)*(l1.start.x-l2.start.x))
+              / ((l2.end.y-l2.start.y)*(l1.end.x-l1.start.x) - (l2.end.x-l2.start.x)*(l1.end.y-l1.start.y));
+
+    if (uA >= 0 && uA <= 1 && uB >= 0 && uB <= 1) {
+        collision_point->x = l1.start.x + (uA * (l1.end.x-l1.start.x));
+        collision_point->y = l1.start.y + (uA * (l1.end.y-l1.start.y));
+        return true;
+    }
+    return false;
+}
+
+// index of the edge of c2 that the first colliding edge of c1 crosses, or -1
+int collision_edge(const collider_t *c1, vector_t position1, const collider_t *c2,
+                   vector_t position2, vector_t *collision_point, line_t *collision_line) {
+    int i, j;
+    line_t line_i, line_j;
+    for(i=0; i<c1->vertex_count; ++i) {
+        line_i.start = vector_add(position1, c1->vertices[i]);
+        line_i.end = vector_add(position1, c1->vertices[i == c1->vertex_count-1 ? 0 : i+1]);
+        for(j=0; j<c2->vertex_count; ++j) {
+            line_j.start = vector_add(position2, c2->vertices[j]);
+            line_j.end = vector_add(position2, c2->vertices[j == c2->vertex_count-1 ? 0 : j+1]);
+            PROFILE_LINE_TEST();
+            if(lines_collide(line_i, line_j, collision_point)) {
+                *collision_line = line_j;
+                return j;
+            }
+        }
+    }
+    return -1;
+}
+
+// only use collision_point if function returns true 
+bool collides(collider_t c1, vector_t position1, collider_t c2, 
+                vector_t position2, vector_t *collision_point, line_t *collision_line) {
+    return collision_edge(&c1, position1, &c2, position2, collision_point, collision_line) >= 0;
+}
+
+// unit normal of each edge, the same one tick would get from the edge's line
+void collider_normals(const collider_t *collider, vector_t *normals) {
+    int i;
+    vector_t start, end;
+    for(i=0; i<collider->vertex_count; ++i) {
+        start = collider->vertices[i];
+        end = collider->vertices[i == collider->vertex_count-1 ? 0 : i+1];
+        normals[i] = vector_normalize((vector_t){start.y-end.y, end.x-start.x});
+    }
+}
+
+typedef struct aabb_s {
+    vector_t min, max;
+} aabb_t;
+
+aabb_t collider_bounds(const collider_t *collider, vector_t position) {
+    aabb_t bounds = {position, position};
+    int i;
+    vector_t vertex;
+    for(i=0; i<collider->vertex_count; ++i) {
+        vertex = vector_add(position, collider->vertices[i]);
+        bounds.min.x = fmin(bounds.min.x, vertex.x);
+        bounds.min.y = fmin(bounds.min.y, vertex.y);
+        bounds.max.x = fmax(bounds.max.x, vertex.x);
+        bounds.max.y = fmax(bounds.max.y, vertex.y);
+    }
+    return bounds;
+}
+
+bool aabbs_overlap(aabb_t a, aabb_t b) {
+    return a.min.x <= b.max.x && a.max.x >= b.min.x
+        && a.min.y <= b.max.y && a.max.y >= b.min.y;
+}
+
+typedef struct material_s {
+    double bounciness;
+    double friction_static;
+    double friction_kinetic;
+} material_t;
+
+// bounds and normals are filled in when the sobj is added to a simulation
+typedef struct sobj_s {
+    vector_t position;
+    collider_t collider;
+    material_t material;
+    aabb_t bounds;
+    vector_t normals[MAX_COLLIDER_VERTICES];
+    int layer; // 0 to 31, raycasts can skip layers
+} sobj_t;
+
+// bounds and normals follow from the collider and position
+void sobj_derive(sobj_t *sobj) {
+    sobj->bounds = collider_bounds(&sobj->collider, sobj->position);
+    collider_normals(&sobj->collider, sobj->normals);
+}
+
+// an edge's cached normal, or worked out from the edge if it was never computed
+vector_t sobj_edge_normal(const sobj_t *sobj, int edge) {
+    vector_t start, end;
+    if(sobj->normals[edge].x != 0 || sobj->normals[edge].y != 0) {
+        return sobj->normals[edge];
+    }
+    start = sobj->collider.vertices[edge];
+    end = sobj->collider.vertices[edge == sobj->collider.vertex_count-1 ? 0 : edge+1];
+    return vector_normalize((vector_t){start.y-end.y, end.x-start.x});
+}
+
+// id is assigned when the mobj is added to a simulation, leave it 0
+typedef struct mobj_s {
+    int id;
+    vector_t position, velocity;
+    double angular_velocity;
+    double angle; // total rotation already applied to collider
+    collider_t collider;
+    material_t material;
+    double mass;
+    int layer; // 0 to 31, raycasts can skip layers
+} mobj_t;
+
+void mobj_apply_torque(mobj_t *mobj, double torque) {
+    mobj->angular_velocity += torque/mobj->mass;
+}
+
+void mobj_apply_force(mobj_t *mobj, vector_t force, vector_t position) {
+    if(force.x == 0 && force.y == 0) {
+        return;
+    }
+    mobj->velocity = vector_add(mobj->velocity, vector_multiply(force, 1.0/mobj->mass));
+    vector_t cg_dist = vector_sub(mobj->position, position);
+    vector_t projection = vector_proj(force, cg_dist);
+    double distance = vector_distance(cg_dist, projection);
+    char direction = vector_cross_z(cg_dist, projection) > 0 ? 1 : -1;
+    mobj_apply_torque(mobj, direction*distance/M_PI/180/6);
+}
+
+// force pushing a mobj back out of a sobj along the sobj's edge normal
+vector_t sobj_normal_force(const mobj_t *mobj, vector_t normal) {
+    return vector_multiply( // TODO ADD ANGULAR VELOCITY TO THIS
+        normal,
+        mobj->mass * vector_magnitude(vector_proj(normal, mobj->velocity))
+    );
+}
+
+// applies the normal force and the bounciness force of mobj hitting sobj at point,
+// returns the total impulse
+double sobj_bounce(mobj_t *mobj, const sobj_t *sobj, vector_t normal, vector_t normal_force, vector_t point) {
+    double bounce = vector_magnitude(mobj->velocity) * mobj->mass * mobj->material.bounciness * sobj->material.bounciness;
+    mobj_apply_force(
+        mobj,
+        normal_force,
+        point
+    );
+    // bounciness force
+    mobj_apply_force(
+        mobj,
+        vector_multiply(normal, bounce),
+        point
+    );
+    return vector_magnitude(normal_force) + bounce;
+}
+
+#ifdef USE_BLOCKMAP
+// uniform grid of BLOCKMAP_COUNT x BLOCKMAP_COUNT cells, each BLOCKMAP_SIZE units square,
+// laid over the sobjs' bounds and listing the sobjs touching each cell
+// the lists are flattened, cell c's sobjs are entries[cells[c]] up to entries[cells[c+1]]
+// sobjs and mobjs past the edge of the grid are clamped into the edge cells
+typedef struct blockmap_s {
+    int version; // sobj_version the blockmap was built for
+    bool valid; // false if the entries overflowed, sobjs are then tested linearly
+    vector_t origin;
+    int width, height;
+    int entry_count;
+    int cells[BLOCKMAP_COUNT*BLOCKMAP_COUNT+1];
+    int entries[BLOCKMAP_ENTRIES];
+} blockmap_t;
+
+int blockmap_cell(double position, double origin, int count) {
+    int cell = (int)floor((position-origin) / BLOCKMAP_SIZE);
+    return cell < 0 ? 0 : cell >= count ? count-1 : cell;
+}
+
+// counting sort of sobjs into cells, two passes and no scratch memory
+void blockmap_build(blockmap_t *blockmap, const sobj_t *sobjs, int sobj_count, int version) {
+    int i, x, y, cell, x0, y0, x1, y1, total = 0;
+    aabb_t world = {zero_vector, zero_vector};
+    for(i=0; i<sobj_count; ++i) {
+        if(i == 0) {
+            world = sobjs[i].bounds;
+        }
+        world.min.x = fmin(world.min.x, sobjs[i].bounds.min.x);
+        world.min.y = fmin(world.min.y, sobjs[i].bounds.min.y);
+        world.max.x = fmax(world.max.x, sobjs[i].bounds.max.x);
+        world.max.y = fmax(world.max.y, sobjs[i].bounds.max.y);
+    }
+    blockmap->origin = world.min;
+    blockmap->width = (int)fmin(BLOCKMAP_COUNT, floor((world.max.x-world.min.x) / BLOCKMAP_SIZE) + 1);
+    blockmap->height = (int)fmin(BLOCKMAP_COUNT, floor((world.max.y-world.min.y) / BLOCKMAP_SIZE) + 1);
+    SDL_memset(blockmap->cells, 0, (blockmap->width*blockmap->height+1) * sizeof(int));
+
+    // count into cells[c+1] so the prefix sum leaves each cell's start in cells[c]
+    for(i=0; i<sobj_count; ++i) {
+        x0 = blockmap_cell(sobjs[i].bounds.min.x, world.min.x, blockmap->width);
+        x1 = blockmap_cell(sobjs[i].bounds.max.x, world.min.x, blockmap->width);
+        y0 = blockmap_cell(sobjs[i].bounds.min.y, world.min.y, blockmap->height);
+        y1 = blockmap_cell(sobjs[i].bounds.max.y, world.min.y, blockmap->height);
+        total += (x1-x0+1) * (y1-y0+1);
+        for(y=y0; y<=y1; ++y) {
+            for(x=x0; x<=x1; ++x) {
+                ++blockmap->cells[y*blockmap->width + x + 1];
+            }
+        }
+    }
+    blockmap->valid = total <= BLOCKMAP_ENTRIES;
+    blockmap->entry_count = 0;
+    if(!blockmap->valid) {
+#ifdef VERBOSE
+        printf("blockmap needs %d entries, BLOCKMAP_ENTRIES is %d\n", total, BLOCKMAP_ENTRIES);
+#endif
+        blockmap->version = version;
+        return;
+    }
+    for(cell=0; cell<blockmap->width*blockmap->height; ++cell) {
+        blockmap->cells[cell+1] += blockmap->cells[cell];
+    }
+
+    // filling advances each cell's start to its end, which is the next cell's start
+    for(i=0; i<sobj_count; ++i) {
+        x0 = blockmap_cell(sobjs[i].bounds.min.x, world.min.x, blockmap->width);
+        x1 = blockmap_cell(sobjs[i].bounds.max.x, world.min.x, blockmap->width);
+        y0 = blockmap_cell(sobjs[i].bounds.min.y, world.min.y, blockmap->height);
+        y1 = blockmap_cell(sobjs[i].bounds.max.y, world.min.y, blockmap->height);
+        for(y=y0; y<=y1; ++y) {
+            for(x=x0; x<=x1; ++x) {
+                blockmap->entries[blockmap->cells[y*blockmap->width + x]++] = i;
+            }
+        }
+    }
+    for(cell=blockmap->width*blockmap->height; cell>0; --cell) {
+        blockmap->cells[cell] = blockmap->cells[cell-1];
+    }
+    blockmap->cells[0] = 0;
+    blockmap->entry_count = total;
+    // set last so a blockmap that's still being built never looks current
+    blockmap->version = version;
+}
+
+// writes the indices of sobjs in the cells bounds covers into candidates, every sobj if the
+// blockmap isn't valid, in ascending order so they're tested in the same order as a linear scan
+// their own bounds aren't checked against bounds, callers do that
+int blockmap_query(const blockmap_t *blockmap, const sobj_t *sobjs, int sobj_count,
+                   aabb_t bounds, int *candidates) {
+    int count = 0, i, j, x, y, sobj, x0, y0, x1, y1;
+    if(!blockmap->valid) {
+        for(i=0; i<sobj_count; ++i) {
+            candidates[count++] = i;
+        }
+        return count;
+    }
+    x0 = blockmap_cell(bounds.min.x, blockmap->origin.x, blockmap->width);
+    x1 = blockmap_cell(bounds.max.x, blockmap->origin.x, blockmap->width);
+    y0 = blockmap_cell(bounds.min.y, blockmap->origin.y, blockmap->height);
+    y1 = blockmap_cell(bounds.max.y, blockmap->origin.y, blockmap->height);
+    for(y=y0; y<=y1; ++y) {
+        for(x=x0; x<=x1; ++x) {
+            for(i=blockmap->cells[y*blockmap->width + x]; i<blockmap->cells[y*blockmap->width + x + 1]; ++i) {
+                sobj = blockmap->entries[i];
+                // a sobj spanning several cells is only taken from the first cell both cover
+                if(x != (int)fmax(x0, blockmap_cell(sobjs[sobj].bounds.min.x, blockmap->origin.x, blockmap->width))
+                   || y != (int)fmax(y0, blockmap_cell(sobjs[sobj].bounds.min.y, blockmap->origin.y, blockmap->height))) {
+                    continue;
+                }
+                for(j=count++; j>0 && candidates[j-1] > sobj; --j) {
+                    candidates[j] = candidates[j-1];
+                }
+                candidates[j] = sobj;
+            }
+        }
+    }
+    return count;
+}
+#endif
+
+#ifdef USE_COMMAND_QUEUE
+typedef enum command_type_e {
+    COMMAND_SPAWN,
+    COMMAND_REMOVE,
+    COMMAND_APPLY_FORCE,
+    COMMAND_APPLY_TORQUE,
+    COMMAND_SET_VELOCITY
+} command_type_t;
+
+typedef struct command_s {
+    command_type_t type;
+    int id;
+    union {
+        mobj_t mobj;
+        struct {
+            vector_t force, position;
+        } force;
+        double torque;
+        struct {
+            vector_t velocity;
+            double angular_velocity;
+        } velocity;
+    };
+} command_t;
+
+// sequence is stored relative to the slot index so a zeroed queue is a valid empty queue
+typedef struct command_slot_s {
+    SDL_atomic_t sequence;
+    command_t command;
+} command_slot_t;
+
+// bounded multi producer, single consumer ring
+// any thread may push, only the thread calling tick() drains
+typedef struct command_queue_s {
+    command_slot_t slots[COMMAND_QUEUE_SIZE];
+    SDL_atomic_t head;
+    unsigned int tail;
+    SDL_atomic_t spawns; // spawns pushed but not applied yet
+} command_queue_t;
+#endif
+
+#ifdef USE_CONTACT_EVENTS
+typedef enum contact_type_e {
+    CONTACT_BEGIN,
+    CONTACT_PERSIST,
+    CONTACT_END
+} contact_type_t;
+
+// other is a mobj id, or a sobj index when other_is_sobj
+// a pair of mobjs is reported once, mobj_id being the lower of the two ids
+// point and normal are from the last substep the pair touched in, normal points toward mobj_id,
+// impulse is summed over the tick and is 0 for CONTACT_END
+typedef struct contact_event_s {
+    contact_type_t type;
+    int mobj_id, other;
+    bool other_is_sobj;
+    vector_t point, normal;
+    double impulse;
+} contact_event_t;
+
+// return false to drop the event
+typedef bool (*contact_filter_t)(const contact_event_t *event, void *data);
+#endif
+
+#ifdef DEBUG_CAPTURE_TICKS
+typedef struct debug_contact_s {
+    line_t edge;
+    vector_t point;
+    line_t normal_force;
+} debug_contact_t;
+
+// other is a mobj id, or a sobj index when other_is_sobj
+typedef struct debug_pair_s {
+    int mobj_id, other;
+    bool other_is_sobj;
+} debug_pair_t;
+
+typedef struct debug_frame_s {
+    debug_contact_t contacts[DEBUG_CAPTURE_CONTACTS];
+    int contact_count;
+    debug_pair_t pairs[DEBUG_CAPTURE_PAIRS];
+    int pair_count;
+} debug_frame_t;
+
+// frames[frame] is the tick in progress, older ticks precede it
+typedef struct debug_capture_s {
+    debug_frame_t frames[DEBUG_CAPTURE_TICKS];
+    int frame;
+} debug_capture_t;
+#endif
+
+// begin_loop presents frame_rate frames per second, 0 uses tick_rate
+// with USE_VSYNC frames are paced by the display instead
+// tick_time and frame_time are measured by begin_loop, in milliseconds
+typedef struct simulation_s {
+    int tick_rate;
+    int frame_rate;
+    double tick_time, frame_time;
+    sobj_t sobjs[MAX_SOBJ_COUNT];
+    int sobj_count;
+    int sobj_version; // changes whenever sobjs are added or removed, bump it after writing sobjs[] directly
+    int sobj_derived_version; // sobj_version the sobjs' bounds and normals were last computed for
+    // set on forks, tick collides with this simulation's sobjs instead of its own
+    const struct simulation_s *static_world;
+#ifdef USE_PHYSICS_THREAD
+    bool sobjs_frozen; // set while a physics thread runs, the render thread reads sobjs then
+#endif
+    mobj_t mobjs[MAX_MOBJ_COUNT];
+    int mobj_count;
+    vector_t gravity;
+    double air_resistance;
+    SDL_atomic_t next_id;
+#ifdef USE_BLOCKMAP
+    blockmap_t blockmap; // rebuilt by tick when it falls behind sobj_version
+#endif
+#ifdef USE_PROFILER
+    tick_stats_t stats;
+#endif
+#ifdef USE_TICK_HISTOGRAM
+    histogram_t tick_histogram; // nanoseconds
+#endif
+#ifdef USE_COMMAND_QUEUE
+    command_queue_t commands;
+#endif
+#ifdef USE_CONTACT_EVENTS
+    contact_filter_t contact_filter;
+    void *contact_filter_data;
+    contact_event_t contact_events[CONTACT_EVENT_BUFFER_SIZE];
+    unsigned int contact_event_head, contact_event_tail;
+    unsigned int contact_events_dropped;
+    contact_event_t contacts[MAX_CONTACT_PAIRS], previous_contacts[MAX_CONTACT_PAIRS];
+    int contact_count, previous_contact_count;
+#endif
+#ifdef DEBUG_SHOW_LAST_COLLISION
+    line_t debug_collision_line, debug_normal_force;
+#endif
+#ifdef DEBUG_CAPTURE_TICKS
+    debug_capture_t debug_capture;
+#endif
+} simulation_t;
+
+#ifndef NO_DEFAULT_SIMULATION
+const simulation_t default_simulation = {
+    .tick_rate = 60,
+    .sobj_count = 0,
+    .mobj_count = 0,
+    .gravity = {0, 0.098},
+    .air_resistance = 0
+};
+#endif
+
+// same state as default_simulation without needing a copy of it
+void simulation_init(simulation_t *simulation) {
+    SDL_memset(simulation, 0, sizeof(simulation_t));
+    simulation->tick_rate = 60;
+    simulation->gravity = (vector_t){0, 0.098};
+}
+
+// safe to call from any thread
+int simulation_reserve_id(simulation_t *simulation) {
+    return SDL_AtomicAdd(&simulation->next_id, 1) + 1;
+}
+
+void simulation_add_mobj(simulation_t *simulation, mobj_t mobj) {
+#ifdef CATCH_OBJECT_OVERFLOW
+    if(simulation->mobj_count == MAX_MOBJ_COUNT) {
+        return;
+    }
+#endif
+    if(mobj.id == 0) {
+        mobj.id = simulation_reserve_id(simulation);
+    }
+    simulation->mobjs[simulation->mobj_count++] = mobj;
+}
+
+// returns NULL if no mobj has that id
+mobj_t *simulation_find_mobj(simulation_t *simulation, int id) {
+    int i;
+    for(i=0; i<simulation->mobj_count; ++i) {
+        if(simulation->mobjs[i].id == id) {
+            return &simulation->mobjs[i];
+        }
+    }
+    return NULL;
+}
+
+// the last mobj takes the removed one's place
+void simulation_remove_mobj(simulation_t *simulation, int id) {
+    mobj_t *mobj = simulation_find_mobj(simulation, id);
+    if(mobj) {
+        *mobj = simulation->mobjs[--simulation->mobj_count];
+    }
+}
+
+// sobjs and what's derived from them are shared with the render thread without a copy,
+// so while a physics thread runs nothing may add, remove or load them
+bool simulation_sobjs_frozen(const simulation_t *simulation) {
+#ifdef USE_PHYSICS_THREAD
+    if(simulation->sobjs_frozen) {
+#ifdef VERBOSE
+        printf("sobjs can't change while the physics thread runs\n");
+#endif
+        return true;
+    }
+#endif
+    (void)simulation;
+    return false;
+}
+
+void simulation_add_sobj(simulation_t *simulation, sobj_t sobj) {
+    if(simulation_sobjs_frozen(simulation)) {
+        return;
+    }
+#ifdef CATCH_OBJECT_OVERFLOW
+    if(simulation->sobj_count == MAX_SOBJ_COUNT) {
+        return;
+    }
+#endif
+    sobj_derive(&sobj);
+    simulation->sobjs[simulation->sobj_count++] = sobj;
+    // the others' bounds and normals still hold, so this one doesn't send them all to be recomputed
+    if(simulation->sobj_derived_version == simulation->sobj_version) {
+        ++simulation->sobj_derived_version;
+    }
+    ++simulation->sobj_version;
+}
+
+// later sobjs shift down one index
+void simulation_remove_sobj(simulation_t *simulation, int index) {
+    if(simulation_sobjs_frozen(simulation) || index < 0 || index >= simulation->sobj_count) {
+        return;
+    }
+    --simulation->sobj_count;
+    SDL_memmove(&simulation->sobjs[index], &simulation->sobjs[index+1],
+                (simulation->sobj_count-index) * sizeof(sobj_t));
+    if(simulation->sobj_derived_version == simulation->sobj_version) {
+        ++simulation->sobj_derived_version;
+    }
+    ++simulation->sobj_version;
+}
+
+// recomputes what's derived from sobjs[] once sobj_version has moved on, every sobj's
+// bounds and normals, then with USE_BLOCKMAP the blockmap over them
+// tick and simulation_fork call this, queries on a const simulation use what it last left
+void simulation_update_sobjs(simulation_t *simulation) {
+    int i;
+    if(simulation->sobj_derived_version != simulation->sobj_version) {
+        for(i=0; i<simulation->sobj_count; ++i) {
+            sobj_derive(&simulation->sobjs[i]);
+        }
+        simulation->sobj_derived_version = simulation->sobj_version;
+    }
+#ifdef USE_BLOCKMAP
+    if(simulation->blockmap.version != simulation->sobj_version) {
+        blockmap_build(&simulation->blockmap, simulation->sobjs, simulation->sobj_count, simulation->sobj_version);
+    }
+#endif
+}
+
+#ifdef USE_COMMAND_QUEUE
+// drops whatever is still queued, touching only the slots that hold a command
+void command_queue_discard(command_queue_t *queue) {
+    command_slot_t *slot;
+    unsigned int lap;
+    for(;;) {
+        slot = &queue->slots[queue->tail & (COMMAND_QUEUE_SIZE-1)];
+        lap = queue->tail & ~(COMMAND_QUEUE_SIZE-1);
+        if((unsigned int)SDL_AtomicGet(&slot->sequence) != lap + 1) {
+            break;
+        }
+        SDL_AtomicSet(&slot->sequence, lap + COMMAND_QUEUE_SIZE);
+        ++queue->tail;
+    }
+    SDL_AtomicSet(&queue->spawns, 0);
+}
+#endif
+
+// sets up fork to run on from parent's current state without copying parent's sobjs,
+// the fork collides with parent's sobjs in place so they must not change while it's in use
+// only the live mobjs and what tick needs are written, fork's unused arrays are never touched,
+// so a fork costs about mobj_count mobjs however large simulation_t is
+// discarding a fork is just not using it again, the same storage can be forked into next frame
+// storage that has never held a simulation must start zeroed, static or simulation_init
+// callbacks, stats and queued commands are not carried over, the tick histogram is left
+// as the storage last had it, histogram_reset it before reading a fork's
+void simulation_fork(simulation_t *fork, simulation_t *parent) {
+    const simulation_t *world = parent->static_world ? parent->static_world : parent;
+    if(world == parent) {
+        simulation_update_sobjs(parent);
+    }
+    fork->tick_rate = parent->tick_rate;
+    fork->frame_rate = parent->frame_rate;
+    fork->tick_time = parent->tick_time;
+    fork->frame_time = parent->frame_time;
+    fork->sobj_count = 0;
+    fork->sobj_version = 0;
+    fork->static_world = world;
+#ifdef USE_PHYSICS_THREAD
+    fork->sobjs_frozen = false;
+#endif
+    fork->mobj_count = parent->mobj_count;
+    SDL_memcpy(fork->mobjs, parent->mobjs, parent->mobj_count*sizeof(mobj_t));
+    fork->gravity = parent->gravity;
+    fork->air_resistance = parent->air_resistance;
+    SDL_AtomicSet(&fork->next_id, SDL_AtomicGet(&parent->next_id));
+#ifdef USE_BLOCKMAP
+    fork->blockmap.version = 0;
+    fork->blockmap.valid = false;
+#endif
+#ifdef USE_PROFILER
+    tick_stats_reset(&fork->stats);
+#endif
+#ifdef USE_COMMAND_QUEUE
+    command_queue_discard(&fork->commands);
+#endif
+#ifdef USE_CONTACT_EVENTS
+    fork->contact_filter = NULL;
+    fork->contact_filter_data = NULL;
+    fork->contact_event_head = fork->contact_event_tail = 0;
+    fork->contact_events_dropped = 0;
+    fork->contact_count = 0;
+    fork->previous_contact_count = parent->previous_contact_count;
+    SDL_memcpy(fork->previous_contacts, parent->previous_contacts, parent->previous_contact_count*sizeof(contact_event_t));
+#endif
+#ifdef DEBUG_CAPTURE_TICKS
+    int i;
+    fork->debug_capture.frame = 0;
+    for(i=0; i<DEBUG_CAPTURE_TICKS; ++i) {
+        fork->debug_capture.frames[i].contact_count = 0;
+        fork->debug_capture.frames[i].pair_count = 0;
+    }
+#endif
+}
+
+#ifdef USE_COMMAND_QUEUE
+// returns false without blocking if the queue is full
+bool simulation_push_command(simulation_t *simulation, const command_t *command) {
+    command_queue_t *queue = &simulation->commands;
+    command_slot_t *slot;
+    unsigned int position = SDL_AtomicGet(&queue->head);
+    int difference;
+    for(;;) {
+        slot = &queue->slots[position & (COMMAND_QUEUE_SIZE-1)];
+        difference = (int)((unsigned int)SDL_AtomicGet(&slot->sequence) - (position & ~(COMMAND_QUEUE_SIZE-1)));
+        if(difference == 0) {
+            if(SDL_AtomicCAS(&queue->head, position, position+1)) {
+                break;
+            }
+        } else if(difference < 0) {
+            return false;
+        }
+        position = SDL_AtomicGet(&queue->head);
+    }
+    slot->command = *command;
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&slot->sequence, (position & ~(COMMAND_QUEUE_SIZE-1)) + 1);
+    return true;
+}
+
+// returns the id the mobj will have once spawned, or 0 if the queue is full
+// or the mobjs already there plus the spawns still queued would fill MAX_MOBJ_COUNT
+// mobj_count is read without a lock, drain counts a spawn as a mobj before it
+// stops counting it as queued so a stale read can only turn a spawn away early
+int simulation_command_spawn(simulation_t *simulation, mobj_t mobj) {
+    command_t command = {.type = COMMAND_SPAWN, .mobj = mobj};
+    if(SDL_AtomicAdd(&simulation->commands.spawns, 1) + simulation->mobj_count >= MAX_MOBJ_COUNT) {
+        SDL_AtomicAdd(&simulation->commands.spawns, -1);
+        return 0;
+    }
+    command.mobj.id = command.id = simulation_reserve_id(simulation);
+    if(!simulation_push_command(simulation, &command)) {
+        SDL_AtomicAdd(&simulation->commands.spawns, -1);
+        return 0;
+    }
+    return command.id;
+}
+
+bool simulation_command_remove(simulation_t *simulation, int id) {
+    command_t command = {.type = COMMAND_REMOVE, .id = id};
+    return simulation_push_command(simulation, &command);
+}
+
+bool simulation_command_apply_force(simulation_t *simulation, int id, vector_t force, vector_t position) {
+    command_t command = {.type = COMMAND_APPLY_FORCE, .id = id, .force = {force, position}};
+    return simulation_push_command(simulation, &command);
+}
+
+bool simulation_command_apply_torque(simulation_t *simulation, int id, double torque) {
+    command_t command = {.type = COMMAND_APPLY_TORQUE, .id = id, .torque = torque};
+    return simulation_push_command(simulation, &command);
+}
+
+bool simulation_command_set_velocity(simulation_t *simulation, int id, vector_t velocity, double angular_velocity) {
+    command_t command = {.type = COMMAND_SET_VELOCITY, .id = id, .velocity = {velocity, angular_velocity}};
+    return simulation_push_command(simulation, &command);
+}
+
+void simulation_apply_command(simulation_t *simulation, const command_t *command) {
+    if(command->type == COMMAND_SPAWN) {
+        simulation_add_mobj(simulation, command->mobj);
+        return;
+    }
+    if(command->type == COMMAND_REMOVE) {
+        simulation_remove_mobj(simulation, command->id);
+        return;
+    }
+    mobj_t *mobj = simulation_find_mobj(simulation, command->id);
+    if(!mobj) {
+        return;
+    }
+    switch(command->type) {
+        case COMMAND_APPLY_FORCE:
+            mobj_apply_force(mobj, command->force.force, command->force.position);
+            break;
+        case COMMAND_APPLY_TORQUE:
+            mobj_apply_torque(mobj, command->torque);
+            break;
+        case COMMAND_SET_VELOCITY:
+            mobj->velocity = command->velocity.velocity;
+            mobj->angular_velocity = command->velocity.angular_velocity;
+            break;
+        default:
+            break;
+    }
+}
+
+// called at the start of every tick, only from the thread running tick()
+void simulation_drain_commands(simulation_t *simulation) {
+    command_queue_t *queue = &simulation->commands;
+    command_slot_t *slot;
+    unsigned int lap;
+    for(;;) {
+        slot = &queue->slots[queue->tail & (COMMAND_QUEUE_SIZE-1)];
+        lap = queue->tail & ~(COMMAND_QUEUE_SIZE-1);
+        if((unsigned int)SDL_AtomicGet(&slot->sequence) != lap + 1) {
+            break;
+        }
+        SDL_MemoryBarrierAcquire();
+        simulation_apply_command(simulation, &slot->command);
+        if(slot->command.type == COMMAND_SPAWN) {
+            SDL_AtomicAdd(&queue->spawns, -1);
+        }
+        SDL_MemoryBarrierRelease();
+        SDL_AtomicSet(&slot->sequence, lap + COMMAND_QUEUE_SIZE);
+        ++queue->tail;
+    }
+}
+#endif
+
+#ifdef USE_CONTACT_EVENTS
+contact_event_t *contact_find(contact_event_t *contacts, int count, int mobj_id, int other, bool other_is_sobj) {
+    int i;
+    for(i=0; i<count; ++i) {
+        if(contacts[i].mobj_id == mobj_id && contacts[i].other == other
+           && contacts[i].other_is_sobj == other_is_sobj) {
+            return &contacts[i];
+        }
+    }
+    return NULL;
+}
+
+// called by tick() for every substep a pair touches in
+void simulation_record_contact(simulation_t *simulation, int mobj_id, int other, bool other_is_sobj,
+                               vector_t point, vector_t normal, double impulse) {
+    contact_event_t *contact = contact_find(simulation->contacts, simulation->contact_count, mobj_id, other, other_is_sobj);
+    if(!contact) {
+        if(simulation->contact_count == MAX_CONTACT_PAIRS) {
+            return;
+        }
+        contact = &simulation->contacts[simulation->contact_count++];
+        *contact = (contact_event_t){
+            .mobj_id = mobj_id,
+            .other = other,
+            .other_is_sobj = other_is_sobj
+        };
+    }
+    contact->point = point;
+    contact->normal = normal;
+    contact->impulse += impulse;
+}
+
+void simulation_push_contact_event(simulation_t *simulation, const contact_event_t *event) {
+    if(simulation->contact_filter && !simulation->contact_filter(event, simulation->contact_filter_data)) {
+        return;
+    }
+    if(simulation->contact_event_head - simulation->contact_event_tail == CONTACT_EVENT_BUFFER_SIZE) {
+        ++simulation->contact_events_dropped;
+        return;
+    }
+    simulation->contact_events[simulation->contact_event_head++ & (CONTACT_EVENT_BUFFER_SIZE-1)] = *event;
+}
+
+// compares this tick's contacts against the last tick's, called at the end of tick()
+void simulation_emit_contacts(simulation_t *simulation) {
+    int i;
+    contact_event_t *contact;
+    for(i=0; i<simulation->contact_count; ++i) {
+        contact = &simulation->contacts[i];
+        contact->type = contact_find(simulation->previous_contacts, simulation->previous_contact_count,
+                                     contact->mobj_id, contact->other, contact->other_is_sobj)
+                        ? CONTACT_PERSIST : CONTACT_BEGIN;
+        simulation_push_contact_event(simulation, contact);
+    }
+    for(i=0; i<simulation->previous_contact_count; ++i) {
+        contact = &simulation->previous_contacts[i];
+        if(!contact_find(simulation->contacts, simulation->contact_count,
+                         contact->mobj_id, contact->other, contact->other_is_sobj)) {
+            contact->type = CONTACT_END;
+            contact->impulse = 0;
+            simulation_push_contact_event(simulation, contact);
+        }
+    }
+    SDL_memcpy(simulation->previous_contacts, simulation->contacts, simulation->contact_count*sizeof(contact_event_t));
+    simulation->previous_contact_count = simulation->contact_count;
+    simulation->contact_count = 0;
+}
+
+// copies up to max events out of the ring, returns how many were copied
+int simulation_drain_contacts(simulation_t *simulation, contact_event_t *events, int max) {
+    int count = 0;
+    while(count < max && simulation->contact_event_tail != simulation->contact_event_head) {
+        events[count++] = simulation->contact_events[simulation->contact_event_tail++ & (CONTACT_EVENT_BUFFER_SIZE-1)];
+    }
+    return count;
+}
+#endif
+
+#ifdef DEBUG_CAPTURE_TICKS
+void debug_capture_begin(debug_capture_t *capture) {
+    capture->frame = (capture->frame+1) % DEBUG_CAPTURE_TICKS;
+    capture->frames[capture->frame].contact_count = 0;
+    capture->frames[capture->frame].pair_count = 0;
+}
+
+void debug_capture_pair(debug_capture_t *capture, int mobj_id, int other, bool other_is_sobj) {
+    debug_frame_t *frame = &capture->frames[capture->frame];
+    if(frame->pair_count < DEBUG_CAPTURE_PAIRS) {
+        frame->pairs[frame->pair_count++] = (debug_pair_t){mobj_id, other, other_is_sobj};
+    }
+}
+
+void debug_capture_contact(debug_capture_t *capture, line_t edge, vector_t point, vector_t normal_force) {
+    debug_frame_t *frame = &capture->frames[capture->frame];
+    if(frame->contact_count < DEBUG_CAPTURE_CONTACTS) {
+        frame->contacts[frame->contact_count++] = (debug_contact_t){
+            edge, point, {point, vector_add(point, normal_force)}
+        };
+    }
+}
+
+// copies only the filled part of each frame, snapshots carry the capture this way
+void debug_capture_copy(debug_capture_t *to, const debug_capture_t *from) {
+    int i;
+    to->frame = from->frame;
+    for(i=0; i<DEBUG_CAPTURE_TICKS; ++i) {
+        to->frames[i].contact_count = from->frames[i].contact_count;
+        to->frames[i].pair_count = from->frames[i].pair_count;
+        SDL_memcpy(to->frames[i].contacts, from->frames[i].contacts, from->frames[i].contact_count*sizeof(debug_contact_t));
+        SDL_memcpy(to->frames[i].pairs, from->frames[i].pairs, from->frames[i].pair_count*sizeof(debug_pair_t));
+    }
+}
+#endif
+
+void tick(simulation_t *simulation) {
+    int i, j, step;
+    mobj_t *mobj, *mobj_other;
+    const sobj_t *sobj_other;
+    const simulation_t *world = simulation->static_world ? simulation->static_world : simulation;
+    vector_t old_position, collision_point, normal_vector, normal_force;
+    line_t collision_line;
+    aabb_t bounds;
+#ifdef USE_CONTACT_EVENTS
+    double impulse;
+#endif
+    collider_t old_collider;
+    double old_angle;
+    bool collided;
+    int edge, candidate_count;
+#ifdef USE_BLOCKMAP
+    int k, candidates[MAX_SOBJ_COUNT];
+#endif
+    if(world == simulation) {
+        simulation_update_sobjs(simulation);
+    }
+#ifdef USE_TICK_HISTOGRAM
+    Uint64 histogram_start = SDL_GetPerformanceCounter();
+#endif
+    PROFILE_START();
+#ifdef USE_COMMAND_QUEUE
+    simulation_drain_commands(simulation);
+#endif
+    PROFILE_LAP(simulation, PHASE_COMMANDS);
+#ifdef DEBUG_CAPTURE_TICKS
+    debug_capture_begin(&simulation->debug_capture);
+#endif
+    for(step=0; step < SIMULATION_STEPS; ++step) {
+        TRACE_BEGIN(substep);
+        for(i=0; i<simulation->mobj_count; ++i) {
+            mobj = &simulation->mobjs[i];
+            mobj->velocity = vector_add(mobj->velocity, vector_multiply(simulation->gravity, 1.0/SIMULATION_STEPS));
+            collided = false;
+            old_position = mobj->position;
+            old_collider = mobj->collider;
+            old_angle = mobj->angle;
+            mobj->position = vector_add(mobj->position, vector_multiply(mobj->velocity, 1.0/SIMULATION_STEPS));
+            PROFILE_LAP(simulation, PHASE_INTEGRATE);
+            mobj->collider = rotate(mobj->collider, mobj->angular_velocity/SIMULATION_STEPS);
+            mobj->angle += mobj->angular_velocity/SIMULATION_STEPS;
+            bounds = collider_bounds(&mobj->collider, mobj->position);
+            PROFILE_LAP(simulation, PHASE_ROTATE);
+            // pairs counts what the broadphase hands on, narrowphase_tests those whose bounds overlap
+            for(j=0; j<simulation->mobj_count; ++j) {
+                if(i==j) continue;
+                mobj_other = &simulation->mobjs[j];
+                PROFILE_COUNT(simulation, pairs);
+                if(!aabbs_overlap(bounds, collider_bounds(&mobj_other->collider, mobj_other->position))) {
+                    continue;
+                }
+                PROFILE_COUNT(simulation, narrowphase_tests);
+#ifdef DEBUG_CAPTURE_TICKS
+                if(step == 0) {
+                    debug_capture_pair(&simulation->debug_capture, mobj->id, mobj_other->id, false);
+                }
+#endif
+                if(collides(mobj->collider, mobj->position, mobj_other->collider,
+                            mobj_other->position, &collision_point, &collision_line))
+                {
+                    collided = true;
+                    PROFILE_COUNT(simulation, hits);
+#ifdef DEBUG_SHOW_LAST_COLLISION
+                    simulation->debug_collision_line = collision_line;
+#endif
+#ifdef DEBUG_CAPTURE_TICKS
+                    debug_capture_contact(&simulation->debug_capture, collision_line, collision_point, zero_vector);
+#endif
+#ifdef USE_CONTACT_EVENTS
+                    normal_vector = vector_normalize((vector_t) {
+                        .x = collision_line.start.y-collision_line.end.y,
+                        .y = collision_line.end.x-collision_line.start.x
+                    });
+                    // both bodies stop, taking out their relative velocity needs the reduced mass times it
+                    impulse = mobj->mass * mobj_other->mass / (mobj->mass + mobj_other->mass)
+                        * vector_distance(mobj->velocity, mobj_other->velocity);
+                    if(mobj->id < mobj_other->id) {
+                        simulation_record_contact(simulation, mobj->id, mobj_other->id, false,
+                                                  collision_point, normal_vector, impulse);
+                    } else {
+                        simulation_record_contact(simulation, mobj_other->id, mobj->id, false,
+                                                  collision_point, vector_multiply(normal_vector, -1), impulse);
+                    }
+#endif
+                    mobj->position = old_position;
+                    mobj->collider = old_collider;
+                    mobj->angle = old_angle;
+                    mobj->velocity = zero_vector;
+                    mobj_other->velocity = zero_vector;
+                    // TODO two mobjs colliding
+                    break;
+                }
+            }
+            PROFILE_LAP(simulation, PHASE_MOBJ_COLLISIONS);
+#ifdef USE_BLOCKMAP
+            candidate_count = blockmap_query(&world->blockmap, world->sobjs, world->sobj_count, bounds, candidates);
+            for(k=0; k<candidate_count; ++k) {
+                j = candidates[k];
+#else
+            candidate_count = world->sobj_count;
+            for(j=0; j<candidate_count; ++j) {
+#endif
+                sobj_other = &world->sobjs[j];
+                PROFILE_COUNT(simulation, pairs);
+                if(!aabbs_overlap(bounds, sobj_other->bounds)) {
+                    continue;
+                }
+                PROFILE_COUNT(simulation, narrowphase_tests);
+#ifdef DEBUG_CAPTURE_TICKS
+                if(step == 0) {
+                    debug_capture_pair(&simulation->debug_capture, mobj->id, j, true);
+                }
+#endif
+                edge = collision_edge(&mobj->collider, mobj->position, &sobj_other->collider,
+                                      sobj_other->position, &collision_point, &collision_line);
+                if(edge >= 0)
+                {
+                    collided = true;
+                    PROFILE_COUNT(simulation, hits);
+                    normal_vector = sobj_edge_normal(sobj_other, edge);
+                    // mobj->position = old_position;
+                    // mobj->collider = old_collider;
+                    normal_force = sobj_normal_force(mobj, normal_vector);
+#ifdef DEBUG_SHOW_LAST_COLLISION
+                    simulation->debug_collision_line = collision_line;
+                    simulation->debug_normal_force = (line_t){collision_point, vector_add(collision_point, normal_force)};
+#endif
+#ifdef DEBUG_CAPTURE_TICKS
+                    debug_capture_contact(&simulation->debug_capture, collision_line, collision_point, normal_force);
+#endif
+                    PROFILE_LAP(simulation, PHASE_SOBJ_COLLISIONS);
+#ifdef USE_CONTACT_EVENTS
+                    impulse =
+#endif
+                    sobj_bounce(mobj, sobj_other, normal_vector, normal_force, collision_point);
+                    PROFILE_LAP(simulation, PHASE_FORCES);
+#ifdef USE_CONTACT_EVENTS
+                    simulation_record_contact(simulation, mobj->id, j, true, collision_point, normal_vector, impulse);
+#endif
+                    break;
+                }
+            }
+            PROFILE_LAP(simulation, PHASE_SOBJ_COLLISIONS);
+        }
+        TRACE_END(substep, "substep");
+    }
+#ifdef USE_CONTACT_EVENTS
+    simulation_emit_contacts(simulation);
+#endif
+    PROFILE_LAP(simulation, PHASE_EVENTS);
+    PROFILE_END(simulation);
+#ifdef USE_TICK_HISTOGRAM
+    histogram_record(&simulation->tick_histogram,
+        (Uint64)((SDL_GetPerformanceCounter() - histogram_start) * 1e9 / SDL_GetPerformanceFrequency()));
+#endif
+}
+
+typedef struct prediction_contact_s {
+    int tick; // 0 is the first predicted tick
+    int sobj; // index into the sobjs the mobj collides with
+    vector_t point, normal;
+} prediction_contact_t;
+
+// sobjs whose bounds overlap bounds, through the blockmap when it's current
+int simulation_sobjs_near(const simulation_t *world, aabb_t bounds, int *candidates) {
+    int i, count = 0;
+#ifdef USE_BLOCKMAP
+    int cell_count;
+    if(world->blockmap.version == world->sobj_version) {
+        cell_count = blockmap_query(&world->blockmap, world->sobjs, world->sobj_count, bounds, candidates);
+        for(i=0; i<cell_count; ++i) {
+            if(aabbs_overlap(bounds, world->sobjs[candidates[i]].bounds)) {
+                candidates[count++] = candidates[i];
+            }
+        }
+        return count;
+    }
+#endif
+    for(i=0; i<world->sobj_count; ++i) {
+        if(aabbs_overlap(bounds, world->sobjs[i].bounds)) {
+            candidates[count++] = i;
+        }
+    }
+    return count;
+}
+
+// distance from center to the nearest edge of sobj, or something over limit if that's further
+double sobj_distance(const sobj_t *sobj, vector_t center, double limit) {
+    int i;
+    vector_t start, edge, offset;
+    double t, nearest = limit*limit + 1;
+    center = vector_sub(center, sobj->position);
+    for(i=0; i<sobj->collider.vertex_count; ++i) {
+        start = sobj->collider.vertices[i];
+        offset = vector_sub(center, start);
+        // the edge's line is never further away than the edge itself
+        t = offset.x*sobj->normals[i].x + offset.y*sobj->normals[i].y;
+        if(t > limit || t < -limit) {
+            continue;
+        }
+        edge = vector_sub(sobj->collider.vertices[i == sobj->collider.vertex_count-1 ? 0 : i+1], start);
+        t = (offset.x*edge.x + offset.y*edge.y) / (edge.x*edge.x + edge.y*edge.y);
+        t = t < 0 ? 0 : t > 1 ? 1 : t;
+        offset = vector_sub(offset, vector_multiply(edge, t));
+        nearest = fmin(nearest, offset.x*offset.x + offset.y*offset.y);
+    }
+    return sqrt(nearest);
+}
+
+// sobjs mobj could reach within one tick from where it is, with how far mobj has to travel
+// before its collider can touch each one, a collider can't cross an edge further than radius away
+int predict_candidates(const simulation_t *world, const mobj_t *mobj, double radius, double reach,
+                       int *candidates, double *clearances) {
+    aabb_t bounds = {
+        {mobj->position.x - reach, mobj->position.y - reach},
+        {mobj->position.x + reach, mobj->position.y + reach}
+    };
+    int i, count = 0, found = simulation_sobjs_near(world, bounds, candidates);
+    double distance;
+    for(i=0; i<found; ++i) {
+        distance = sobj_distance(&world->sobjs[candidates[i]], mobj->position, reach);
+        if(distance <= reach) {
+            candidates[count] = candidates[i];
+            clearances[count++] = distance - radius;
+        }
+    }
+    return count;
+}
+
+// runs one mobj forward for up to ticks ticks against the sobjs only, ignoring every other mobj
+// the motion and bounces are tick's, positions[i] is where the mobj is after tick i
+// returns how many positions were written, fewer than ticks once the mobj comes to rest,
+// see PREDICT_REST_DISTANCE, the positions after that would all be about the last one
+// contacts gets up to max_contacts contacts and contact_count how many there were in total
+// ticks with no sobj in reach are advanced in one step instead of SIMULATION_STEPS,
+// a sobj is only tested once the mobj could have closed the gap to it, and the collider
+// is only rotated for those tests, results match tick up to rounding
+// 300 ticks mostly in flight take about 20us with USE_BLOCKMAP, ticks spent touching
+// a sobj run the narrowphase every substep, so a path that bounces or slides the whole
+// way costs several times that, around 120us for 300 ticks among 300 sobjs
+int simulation_predict(const simulation_t *simulation, mobj_t mobj, int ticks, vector_t *positions,
+                       prediction_contact_t *contacts, int max_contacts, int *contact_count) {
+    const simulation_t *world = simulation->static_world ? simulation->static_world : simulation;
+    collider_t base = mobj.collider;
+    vector_t previous;
+    double base_angle = mobj.angle, rotated_angle = mobj.angle, radius = 0, distance, travel, travel_step;
+    double clearances[MAX_SOBJ_COUNT];
+    vector_t collision_point, normal;
+    line_t collision_line;
+    const sobj_t *sobj;
+    int candidates[MAX_SOBJ_COUNT], candidate_count, t, step, k, edge, found = 0;
+    for(k=0; k<base.vertex_count; ++k) {
+        radius = fmax(radius, vector_magnitude(base.vertices[k]));
+    }
+    for(t=0; t<ticks; ++t) {
+        previous = mobj.position;
+        // velocity only grows by gravity during a tick, a bounce can at most double it
+        travel_step = 2 * (vector_magnitude(mobj.velocity) + vector_magnitude(simulation->gravity)) / SIMULATION_STEPS;
+        candidate_count = predict_candidates(world, &mobj, radius, radius + travel_step*SIMULATION_STEPS,
+                                             candidates, clearances);
+        travel = 0;
+        // nothing in reach, the substeps sum to this
+        if(candidate_count == 0) {
+            mobj.position = vector_add(mobj.position, vector_add(mobj.velocity,
+                vector_multiply(simulation->gravity, (SIMULATION_STEPS+1) / (2.0*SIMULATION_STEPS))));
+            mobj.velocity = vector_add(mobj.velocity, simulation->gravity);
+            mobj.angle += mobj.angular_velocity;
+            positions[t] = mobj.position;
+            if(vector_distance(previous, mobj.position) < PREDICT_REST_DISTANCE
+               && vector_magnitude(mobj.velocity) < PREDICT_REST_DISTANCE) {
+                ++t;
+                break;
+            }
+            continue;
+        }
+        for(step=0; step<SIMULATION_STEPS; ++step) {
+            mobj.velocity = vector_add(mobj.velocity, vector_multiply(simulation->gravity, 1.0/SIMULATION_STEPS));
+            mobj.position = vector_add(mobj.position, vector_multiply(mobj.velocity, 1.0/SIMULATION_STEPS));
+            mobj.angle += mobj.angular_velocity/SIMULATION_STEPS;
+            travel += travel_step;
+            for(k=0; k<candidate_count; ++k) {
+                if(travel < clearances[k]) {
+                    continue;
+                }
+                sobj = &world->sobjs[candidates[k]];
+                distance = sobj_distance(sobj, mobj.position, radius);
+                if(distance > radius) {
+                    clearances[k] = travel + distance - radius;
+                    continue;
+                }
+                if(rotated_angle != mobj.angle) {
+                    mobj.collider = rotate(base, mobj.angle - base_angle);
+                    rotated_angle = mobj.angle;
+                }
+                edge = collision_edge(&mobj.collider, mobj.position, &sobj->collider, sobj->position,
+                                      &collision_point, &collision_line);
+                if(edge < 0) {
+                    continue;
+                }
+                normal = sobj_edge_normal(sobj, edge);
+                sobj_bounce(&mobj, sobj, normal, sobj_normal_force(&mobj, normal), collision_point);
+                if(found < max_contacts) {
+                    contacts[found] = (prediction_contact_t){t, candidates[k], collision_point, normal};
+                }
+                ++found;
+                // the bounce changed where the mobj can reach for the rest of this tick
+                travel_step = 2 * (vector_magnitude(mobj.velocity) + vector_magnitude(simulation->gravity)) / SIMULATION_STEPS;
+                candidate_count = predict_candidates(world, &mobj, radius, radius + travel_step*SIMULATION_STEPS,
+                                                     candidates, clearances);
+                travel = 0;
+                break;
+            }
+        }
+        positions[t] = mobj.position;
+        if(vector_distance(previous, mobj.position) < PREDICT_REST_DISTANCE
+           && vector_magnitude(mobj.velocity) < PREDICT_REST_DISTANCE) {
+            ++t;
+            break;
+        }
+    }
+    if(contact_count) {
+        *contact_count = found;
+    }
+    return t;
+}
+
+// what a ray hit, fraction is how far along the ray, 0 at its start and 1 at its end
+// normal is the hit edge's unit normal turned to face back along the ray
+typedef struct raycast_hit_s {
+    int body; // sobj index, or mobj id
+    bool is_sobj;
+    vector_t point, normal;
+    double fraction;
+} raycast_hit_t;
+
+// layer mask with every layer set, a body is hit if mask has bit 1 << layer
+#define RAYCAST_ALL_LAYERS 0xFFFFFFFFu
+
+typedef struct raycast_s {
+    vector_t start, delta, inverse;
+    Uint32 layers;
+    raycast_hit_t *hits; // the closest max hits so far, nearest first
+    int count, max;
+} raycast_t;
+
+// fraction along the ray where it crosses the edge from a to b, or -1
+double ray_edge(vector_t start, vector_t delta, vector_t a, vector_t b) {
+    vector_t edge = vector_sub(b, a), offset = vector_sub(a, start);
+    double denominator = vector_cross_z(delta, edge), t, u;
+    if(denominator == 0) {
+        return -1;
+    }
+    t = vector_cross_z(offset, edge) / denominator;
+    u = vector_cross_z(offset, delta) / denominator;
+    return t >= 0 && t <= 1 && u >= 0 && u <= 1 ? t : -1;
+}
+
+// slab test, whether the ray passes through bounds before limit
+// an axis the ray doesn't move along is in or out of its slab for the whole ray, testing it
+// through inverse would give 0*inf = NaN when the start lies on the slab's edge
+bool ray_bounds(const raycast_t *ray, aabb_t bounds, double limit) {
+    double t0, t1, near = -INFINITY, far = INFINITY;
+    if(ray->delta.x == 0) {
+        if(ray->start.x < bounds.min.x || ray->start.x > bounds.max.x) {
+            return false;
+        }
+    } else {
+        t0 = (bounds.min.x - ray->start.x) * ray->inverse.x;
+        t1 = (bounds.max.x - ray->start.x) * ray->inverse.x;
+        near = fmin(t0, t1);
+        far = fmax(t0, t1);
+    }
+    if(ray->delta.y == 0) {
+        if(ray->start.y < bounds.min.y || ray->start.y > bounds.max.y) {
+            return false;
+        }
+    } else {
+        t0 = (bounds.min.y - ray->start.y) * ray->inverse.y;
+        t1 = (bounds.max.y - ray->start.y) * ray->inverse.y;
+        near = fmax(near, fmin(t0, t1));
+        far = fmin(far, fmax(t0, t1));
+    }
+    return near <= far && far >= 0 && near <= limit;
+}
+
+// whether every vertex is on the same side of the ray's line, so the ray can't cross the collider
+bool ray_misses(const raycast_t *ray, const collider_t *collider, vector_t position) {
+    int i, left = 0;
+    vector_t offset = vector_sub(position, ray->start);
+    for(i=0; i<collider->vertex_count; ++i) {
+        left += vector_cross_z(ray->delta, vector_add(offset, collider->vertices[i])) > 0;
+    }
+    return left == 0 || left == collider->vertex_count;
+}
+
+// hits further than this can't make it into the results
+double raycast_limit(const raycast_t *ray) {
+    return ray->count < ray->max ? 1 : ray->hits[ray->max-1].fraction;
+}
+
+// tests one body against the ray and keeps its nearest edge crossing if it's close enough
+// normals can be NULL, they're then worked out for the crossed edge only
+bool raycast_body(raycast_t *ray, const collider_t *collider, vector_t position, aabb_t bounds,
+                  const vector_t *normals, int layer, int body, bool is_sobj) {
+    int i, edge = -1;
+    double t, limit = raycast_limit(ray);
+    vector_t start, end;
+    raycast_hit_t hit;
+    if(!(ray->layers & (1u << (layer & 31))) || !ray_bounds(ray, bounds, limit)) {
+        return false;
+    }
+    for(i=0; i<collider->vertex_count; ++i) {
+        start = vector_add(position, collider->vertices[i]);
+        end = vector_add(position, collider->vertices[i == collider->vertex_count-1 ? 0 : i+1]);
+        t = ray_edge(ray->start, ray->delta, start, end);
+        if(t >= 0 && t <= limit && (edge < 0 || t < hit.fraction)) {
+            edge = i;
+            hit.fraction = t;
+            hit.normal = normals ? normals[i] : vector_normalize((vector_t){start.y-end.y, end.x-start.x});
+        }
+    }
+    if(edge < 0) {
+        return false;
+    }
+    hit.body = body;
+    hit.is_sobj = is_sobj;
+    hit.point = vector_add(ray->start, vector_multiply(ray->delta, hit.fraction));
+    if(vector_dot(hit.normal, ray->delta) > 0) {
+        hit.normal = vector_multiply(hit.normal, -1);
+    }
+    // insertion sort, the furthest hit falls off the end once there are max
+    if(ray->count < ray->max) {
+        ++ray->count;
+    }
+    for(i=ray->count-1; i>0 && ray->hits[i-1].fraction > hit.fraction; --i) {
+        ray->hits[i] = ray->hits[i-1];
+    }
+    ray->hits[i] = hit;
+    return true;
+}
+
+#ifdef USE_BLOCKMAP
+// fraction where the ray leaves column or row cell of the blockmap, cells on the edge
+// of the grid reach out forever like they do in blockmap_cell
+double ray_cell_exit(double start, double delta, double inverse, double origin, int cell, int count) {
+    if(delta > 0 && cell < count-1) {
+        return (origin + (cell+1)*BLOCKMAP_SIZE - start) * inverse;
+    }
+    if(delta < 0 && cell > 0) {
+        return (origin + cell*BLOCKMAP_SIZE - start) * inverse;
+    }
+    return INFINITY;
+}
+
+// walks the blockmap cells the ray passes through in order, stopping once the
+// cells are further along than the hits already kept
+void raycast_blockmap(raycast_t *ray, const simulation_t *world, bool any) {
+    const blockmap_t *blockmap = &world->blockmap;
+    Uint32 tested[(MAX_SOBJ_COUNT+31)/32] = {0};
+    int i, sobj, x, y, step_x = ray->delta.x > 0 ? 1 : -1, step_y = ray->delta.y > 0 ? 1 : -1;
+    double entered = 0, exit_x, exit_y;
+    x = blockmap_cell(ray->start.x, blockmap->origin.x, blockmap->width);
+    y = blockmap_cell(ray->start.y, blockmap->origin.y, blockmap->height);
+    exit_x = ray_cell_exit(ray->start.x, ray->delta.x, ray->inverse.x, blockmap->origin.x, x, blockmap->width);
+    exit_y = ray_cell_exit(ray->start.y, ray->delta.y, ray->inverse.y, blockmap->origin.y, y, blockmap->height);
+    while(entered <= raycast_limit(ray)) {
+        for(i=blockmap->cells[y*blockmap->width + x]; i<blockmap->cells[y*blockmap->width + x + 1]; ++i) {
+            // a sobj spanning several cells is only tested in the first one
+            sobj = blockmap->entries[i];
+            if(tested[sobj/32] & (1u << sobj%32)) {
+                continue;
+            }
+            tested[sobj/32] |= 1u << sobj%32;
+            if(raycast_body(ray, &world->sobjs[sobj].collider, world->sobjs[sobj].position, world->sobjs[sobj].bounds,
+                            world->sobjs[sobj].normals, world->sobjs[sobj].layer, sobj, true) && any) {
+                return;
+            }
+        }
+        if(exit_x < exit_y) {
+            entered = exit_x;
+            x += step_x;
+            exit_x = ray_cell_exit(ray->start.x, ray->delta.x, ray->inverse.x, blockmap->origin.x, x, blockmap->width);
+        } else if(exit_y != INFINITY) {
+            entered = exit_y;
+            y += step_y;
+            exit_y = ray_cell_exit(ray->start.y, ray->delta.y, ray->inverse.y, blockmap->origin.y, y, blockmap->height);
+        } else {
+            break;
+        }
+    }
+}
+#endif
+
+// fills hits with up to max of the bodies ray crosses, nearest first, one hit per body
+// layers is a mask of the layers to test, any stops at the first hit found
+// sobjs go through the blockmap when it's current, mobjs are all checked
+int raycast(const simulation_t *simulation, line_t ray, Uint32 layers, bool any, raycast_hit_t *hits, int max) {
+    const simulation_t *world = simulation->static_world ? simulation->static_world : simulation;
+    const mobj_t *mobj;
+    int i;
+    raycast_t query = {
+        .start = ray.start,
+        .delta = vector_sub(ray.end, ray.start),
+        .layers = layers,
+        .hits = hits,
+        .max = max
+    };
+    if(max <= 0) {
+        return 0;
+    }
+    query.inverse = (vector_t){1/query.delta.x, 1/query.delta.y};
+#ifdef USE_BLOCKMAP
+    if(world->blockmap.version == world->sobj_version && world->blockmap.valid) {
+        raycast_blockmap(&query, world, any);
+    } else
+#endif
+    for(i=0; i<world->sobj_count; ++i) {
+        if(raycast_body(&query, &world->sobjs[i].collider, world->sobjs[i].position, world->sobjs[i].bounds,
+                        world->sobjs[i].normals, world->sobjs[i].layer, i, true) && any) {
+            return query.count;
+        }
+    }
+    for(i=0; i<simulation->mobj_count && !(any && query.count); ++i) {
+        mobj = &simulation->mobjs[i];
+        // mobjs keep no bounds, this throws out most of them before working bounds out
+        if(ray_misses(&query, &mobj->collider, mobj->position)) {
+            continue;
+        }
+        raycast_body(&query, &mobj->collider, mobj->position, collider_bounds(&mobj->collider, mobj->position),
+                     NULL, mobj->layer, mobj->id, false);
+    }
+    return query.count;
+}
+
+// the closest body ray hits, false if it hits nothing
+bool simulation_raycast(const simulation_t *simulation, line_t ray, Uint32 layers, raycast_hit_t *hit) {
+    return raycast(simulation, ray, layers, false, hit, 1) > 0;
+}
+
+// whether ray hits anything at all, cheaper than finding the closest hit for line of sight checks
+bool simulation_raycast_any(const simulation_t *simulation, line_t ray, Uint32 layers) {
+    raycast_hit_t hit;
+    return raycast(simulation, ray, layers, true, &hit, 1) > 0;
+}
+
+// every body ray hits, nearest first, or the closest max of them if it hits more
+int simulation_raycast_all(const simulation_t *simulation, line_t ray, Uint32 layers, raycast_hit_t *hits, int max) {
+    return raycast(simulation, ray, layers, false, hits, max);
+}
+
+// runs ticks back to back with no rendering or sleeping
+void simulation_step(simulation_t *simulation, int ticks) {
+    int i;
+    for(i=0; i<ticks; ++i) {
+        tick(simulation);
+    }
+}
+
+double counter_to_ms(Uint64 counter) {
+    return counter * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+// sleeps most of the way then spins, SDL_Delay alone can oversleep by a few ms
+void wait_until(Uint64 deadline) {
+    Uint64 now = SDL_GetPerformanceCounter();
+    if(deadline <= now) {
+        return;
+    }
+    Uint32 ms = (Uint32)counter_to_ms(deadline - now);
+    if(ms > 1) {
+        SDL_Delay(ms - 1);
+    }
+    while(SDL_GetPerformanceCounter() < deadline);
+}
+
+// copy of everything render needs from the moving objects
+// orientation lives in the rotated collider vertices
+// time is the SDL performance counter when it was taken
+typedef struct snapshot_s {
+    Uint64 time;
+    int mobj_count;
+    int ids[MAX_MOBJ_COUNT];
+    vector_t positions[MAX_MOBJ_COUNT];
+    collider_t colliders[MAX_MOBJ_COUNT];
+    aabb_t bounds[MAX_MOBJ_COUNT]; // worked out once per tick so rendering can cull without the vertices
+#ifdef DEBUG_SHOW_LAST_COLLISION
+    line_t debug_collision_line, debug_normal_force;
+#endif
+#ifdef DEBUG_CAPTURE_TICKS
+    debug_capture_t debug_capture;
+#endif
+} snapshot_t;
+
+void simulation_snapshot(const simulation_t *simulation, snapshot_t *snapshot) {
+    int i;
+    snapshot->time = SDL_GetPerformanceCounter();
+    snapshot->mobj_count = simulation->mobj_count;
+    for(i=0; i<simulation->mobj_count; ++i) {
+        snapshot->ids[i] = simulation->mobjs[i].id;
+        snapshot->positions[i] = simulation->mobjs[i].position;
+        snapshot->colliders[i] = simulation->mobjs[i].collider;
+        snapshot->bounds[i] = collider_bounds(&simulation->mobjs[i].collider, simulation->mobjs[i].position);
+    }
+#ifdef DEBUG_SHOW_LAST_COLLISION
+    snapshot->debug_collision_line = simulation->debug_collision_line;
+    snapshot->debug_normal_force = simulation->debug_normal_force;
+#endif
+#ifdef DEBUG_CAPTURE_TICKS
+    debug_capture_copy(&snapshot->debug_capture, &simulation->debug_capture);
+#endif
+}
+
+// blends every mobj that has the same id at the same index in both snapshots,
+// anything spawned or moved since previous is taken from current as is
+// colliders are blended per vertex, which is close enough to the rotation for one tick
+void snapshot_interpolate(const snapshot_t *previous, const snapshot_t *current, double alpha, snapshot_t *out) {
+    int i, j;
+    const collider_t *from, *to;
+    out->time = current->time;
+    out->mobj_count = current->mobj_count;
+    for(i=0; i<current->mobj_count; ++i) {
+        out->ids[i] = current->ids[i];
+        from = &previous->colliders[i];
+        to = &current->colliders[i];
+        if(i >= previous->mobj_count || previous->ids[i] != current->ids[i] || from->vertex_count != to->vertex_count) {
+            out->positions[i] = current->positions[i];
+            out->colliders[i] = *to;
+            out->bounds[i] = current->bounds[i];
+            continue;
+        }
+        out->positions[i] = vector_lerp(previous->positions[i], current->positions[i], alpha);
+        // blended vertices stay inside the blended bounds
+        out->bounds[i] = (aabb_t){
+            vector_lerp(previous->bounds[i].min, current->bounds[i].min, alpha),
+            vector_lerp(previous->bounds[i].max, current->bounds[i].max, alpha)
+        };
+        out->colliders[i].vertex_count = to->vertex_count;
+        for(j=0; j<to->vertex_count; ++j) {
+            out->colliders[i].vertices[j] = vector_lerp(from->vertices[j], to->vertices[j], alpha);
+        }
+    }
+#ifdef DEBUG_SHOW_LAST_COLLISION
+    out->debug_collision_line = current->debug_collision_line;
+    out->debug_normal_force = current->debug_normal_force;
+#endif
+#ifdef DEBUG_CAPTURE_TICKS
+    debug_capture_copy(&out->debug_capture, &current->debug_capture);
+#endif
+}
+
+#ifdef USE_MAPPED_FILES
+#include <stdio.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// read only view of a whole file, pages are loaded as they're touched
+typedef struct mapped_file_s {
+    const Uint8 *data;
+    size_t size;
+#ifdef _WIN32
+    HANDLE file, mapping;
+#endif
+} mapped_file_t;
+
+int file_map(mapped_file_t *mapped, const char *path) {
+    mapped->data = NULL;
+    mapped->size = 0;
+#ifdef _WIN32
+    LARGE_INTEGER size;
+    mapped->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if(mapped->file == INVALID_HANDLE_VALUE) {
+        return -1;
+    }
+    if(!GetFileSizeEx(mapped->file, &size) || size.QuadPart == 0) {
+        CloseHandle(mapped->file);
+        return -1;
+    }
+    mapped->mapping = CreateFileMappingA(mapped->file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if(!mapped->mapping) {
+        CloseHandle(mapped->file);
+        return -1;
+    }
+    mapped->data = MapViewOfFile(mapped->mapping, FILE_MAP_READ, 0, 0, 0);
+    if(!mapped->data) {
+        CloseHandle(mapped->mapping);
+        CloseHandle(mapped->file);
+        return -1;
+    }
+    mapped->size = (size_t)size.QuadPart;
+#else
+    struct stat info;
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        return -1;
+    }
+    if(fstat(fd, &info) < 0 || info.st_size == 0) {
+        close(fd);
+        return -1;
+    }
+    void *data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED) {
+        return -1;
+    }
+    mapped->data = data;
+    mapped->size = info.st_size;
+#endif
+    return 0;
+}
+
+void file_unmap(mapped_file_t *mapped) {
+    if(!mapped->data) {
+        return;
+    }
+#ifdef _WIN32
+    UnmapViewOfFile(mapped->data);
+    CloseHandle(mapped->mapping);
+    CloseHandle(mapped->file);
+#else
+    munmap((void *)mapped->data, mapped->size);
+#endif
+    mapped->data = NULL;
+}
+
+bool host_is_little_endian(void) {
+    const Uint32 one = 1;
+    return *(const Uint8 *)&one == 1;
+}
+#endif
+
+#ifdef USE_SAVE_FILES
+// file layout, little endian:
+//   save_header_t
+//   save_section_t[section_count]
+//   section data, each starting on a SAVE_ALIGNMENT boundary
+// section records are the in-memory structs, so loading checks the counts, sizes and
+// the fields used as indices in every section, then copies
+// the header records the struct sizes and MAX_COLLIDER_VERTICES, files from a build
+// where those differ, or from another version, are refused rather than misread
+#define SAVE_MAGIC "PHYSSAVE"
+#define SAVE_VERSION 2
+#define SAVE_ALIGNMENT 64
+
+typedef enum save_section_type_e {
+    SAVE_WORLD = 1,
+    SAVE_MOBJS,
+    SAVE_SOBJS,
+    SAVE_CONTACTS,
+    SAVE_BLOCKMAP
+} save_section_type_t;
+
+// the sections that describe a level rather than the state of play in it
+#define SAVE_LEVEL_SECTIONS ((1 << SAVE_SOBJS) | (1 << SAVE_BLOCKMAP))
+
+typedef struct save_header_s {
+    char magic[8];
+    Uint32 version;
+    Uint32 section_count;
+    Uint32 world_size, mobj_size, sobj_size, contact_size;
+    Uint32 collider_vertices;
+    Uint32 reserved;
+} save_header_t;
+
+typedef struct save_section_s {
+    Uint32 type, count;
+    Uint64 offset, size;
+} save_section_t;
+
+// everything in simulation_t that isn't an object array
+typedef struct save_world_s {
+    int tick_rate, frame_rate;
+    vector_t gravity;
+    double air_resistance;
+    int next_id;
+} save_world_t;
+
+#ifdef USE_CONTACT_EVENTS
+# define SAVE_CONTACT_SIZE sizeof(contact_event_t)
+#else
+# define SAVE_CONTACT_SIZE 0
+#endif
+
+save_header_t save_header(Uint32 section_count) {
+    save_header_t header = {
+        .version = SAVE_VERSION,
+        .section_count = section_count,
+        .world_size = sizeof(save_world_t),
+        .mobj_size = sizeof(mobj_t),
+        .sobj_size = sizeof(sobj_t),
+        .contact_size = SAVE_CONTACT_SIZE,
+        .collider_vertices = MAX_COLLIDER_VERTICES
+    };
+    SDL_memcpy(header.magic, SAVE_MAGIC, 8);
+    return header;
+}
+
+// sections are laid out from the directory and written front to back in one pass
+int save_write(const char *path, save_header_t header, save_section_t *sections, const void **data) {
+    static const Uint8 padding[SAVE_ALIGNMENT] = {0};
+    Uint64 offset = sizeof(save_header_t) + header.section_count*sizeof(save_section_t);
+    Uint32 i;
+    for(i=0; i<header.section_count; ++i) {
+        offset = (offset + SAVE_ALIGNMENT-1) & ~(Uint64)(SAVE_ALIGNMENT-1);
+        sections[i].offset = offset;
+        offset += sections[i].size;
+    }
+
+    FILE *file = fopen(path, "wb");
+    if(!file) {
+#ifdef VERBOSE
+        printf("failed to open %s for writing\n", path);
+#endif
+        return -1;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+           && fwrite(sections, sizeof(save_section_t), header.section_count, file) == header.section_count;
+    offset = sizeof(save_header_t) + header.section_count*sizeof(save_section_t);
+    for(i=0; ok && i<header.section_count; ++i) {
+        ok = fwrite(padding, 1, sections[i].offset - offset, file) == sections[i].offset - offset
+          && fwrite(data[i], 1, sections[i].size, file) == sections[i].size;
+        offset = sections[i].offset + sections[i].size;
+    }
+    if(fclose(file) != 0 || !ok) {
+#ifdef VERBOSE
+        printf("failed to write %s\n", path);
+#endif
+        return -1;
+    }
+    return 0;
+}
+
+// checks the header and returns the section directory, or NULL if the file can't be used
+const save_section_t *save_sections(const mapped_file_t *mapped, const char *path) {
+    const save_header_t *header = (const save_header_t *)mapped->data;
+    save_header_t expected = save_header(0);
+    (void)path;
+    if(!host_is_little_endian() || mapped->size < sizeof(save_header_t)
+       || SDL_memcmp(header->magic, SAVE_MAGIC, 8) != 0 || header->version != SAVE_VERSION
+       || header->world_size != expected.world_size || header->mobj_size != expected.mobj_size
+       || header->sobj_size != expected.sobj_size || header->collider_vertices != expected.collider_vertices
+       || (header->contact_size != 0 && expected.contact_size != 0 && header->contact_size != expected.contact_size)
+       || mapped->size < sizeof(save_header_t) + (Uint64)header->section_count*sizeof(save_section_t)) {
+#ifdef VERBOSE
+        printf("%s is not a save file for this build\n", path);
+#endif
+        return NULL;
+    }
+    const save_section_t *sections = (const save_section_t *)(header + 1);
+    Uint32 i;
+    for(i=0; i<header->section_count; ++i) {
+        if(sections[i].offset > mapped->size || sections[i].size > mapped->size - sections[i].offset) {
+#ifdef VERBOSE
+            printf("%s is truncated\n", path);
+#endif
+            return NULL;
+        }
+    }
+    return sections;
+}
+
+// the section's records if it holds count records of size bytes each, NULL otherwise
+const void *save_section_data(const mapped_file_t *mapped, const save_section_t *section, size_t size, Uint32 max) {
+    if(section->count > max || section->size != (Uint64)section->count*size) {
+        return NULL;
+    }
+    return mapped->data + section->offset;
+}
+
+#ifdef USE_BLOCKMAP
+// a blockmap from a file is only trusted as far as it can't index out of bounds
+bool blockmap_check(const blockmap_t *blockmap, int sobj_count) {
+    int i, cell_count = blockmap->width*blockmap->height;
+    if(!blockmap->valid) {
+        return true;
+    }
+    if(blockmap->width < 1 || blockmap->width > BLOCKMAP_COUNT || blockmap->height < 1 || blockmap->height > BLOCKMAP_COUNT
+       || blockmap->entry_count < 0 || blockmap->entry_count > BLOCKMAP_ENTRIES
+       || blockmap->cells[0] != 0 || blockmap->cells[cell_count] != blockmap->entry_count) {
+        return false;
+    }
+    for(i=0; i<cell_count; ++i) {
+        if(blockmap->cells[i] > blockmap->cells[i+1]) {
+            return false;
+        }
+    }
+    for(i=0; i<blockmap->entry_count; ++i) {
+        if(blockmap->entries[i] < 0 || blockmap->entries[i] >= sobj_count) {
+            return false;
+        }
+    }
+    return true;
+}
+#endif
+
+// writes the sections in types that the simulation has
+int save_write_sections(const simulation_t *simulation, const char *path, Uint32 types) {
+    save_world_t world = {
+        .tick_rate = simulation->tick_rate,
+        .frame_rate = simulation->frame_rate,
+        .gravity = simulation->gravity,
+        .air_resistance = simulation->air_resistance,
+        .next_id = SDL_AtomicGet((SDL_atomic_t *)&simulation->next_id)
+    };
+    save_section_t sections[5];
+    const void *data[5];
+    Uint32 count = 0;
+    if(types & (1 << SAVE_WORLD)) {
+        sections[count] = (save_section_t){SAVE_WORLD, 1, 0, sizeof(world)};
+        data[count++] = &world;
+    }
+    if(types & (1 << SAVE_MOBJS)) {
+        sections[count] = (save_section_t){SAVE_MOBJS, simulation->mobj_count, 0, simulation->mobj_count*sizeof(mobj_t)};
+        data[count++] = simulation->mobjs;
+    }
+    if(types & (1 << SAVE_SOBJS)) {
+        sections[count] = (save_section_t){SAVE_SOBJS, simulation->sobj_count, 0, simulation->sobj_count*sizeof(sobj_t)};
+        data[count++] = simulation->sobjs;
+    }
+#ifdef USE_CONTACT_EVENTS
+    if(types & (1 << SAVE_CONTACTS)) {
+        sections[count] = (save_section_t){
+            SAVE_CONTACTS, simulation->previous_contact_count, 0,
+            simulation->previous_contact_count*sizeof(contact_event_t)
+        };
+        data[count++] = simulation->previous_contacts;
+    }
+#endif
+#ifdef USE_BLOCKMAP
+    // a stale blockmap is left out and rebuilt by the first tick after loading
+    if((types & (1 << SAVE_BLOCKMAP)) && simulation->blockmap.version == simulation->sobj_version) {
+        sections[count] = (save_section_t){SAVE_BLOCKMAP, 1, 0, sizeof(blockmap_t)};
+        data[count++] = &simulation->blockmap;
+    }
+#endif
+    return save_write(path, save_header(count), sections, data);
+}
+
+int simulation_save(const simulation_t *simulation, const char *path) {
+    return save_write_sections(simulation, path, ~0u);
+}
+
+// records are copied as they are, so anything that would later be used as an index is checked first
+bool save_body_check(const collider_t *collider, int layer) {
+    return collider->vertex_count >= 3 && collider->vertex_count <= MAX_COLLIDER_VERTICES && layer >= 0 && layer < 32;
+}
+
+// loads the sections in types that the file has, skipping the rest
+// every wanted section is checked before any is copied, so a bad file leaves the simulation untouched
+int save_load_sections(simulation_t *simulation, const char *path, Uint32 types) {
+    mapped_file_t mapped;
+    if((types & SAVE_LEVEL_SECTIONS) && simulation_sobjs_frozen(simulation)) {
+        return -1;
+    }
+    if(file_map(&mapped, path) < 0) {
+#ifdef VERBOSE
+        printf("failed to map %s\n", path);
+#endif
+        return -1;
+    }
+    const save_section_t *sections = save_sections(&mapped, path);
+    if(!sections) {
+        file_unmap(&mapped);
+        return -1;
+    }
+    const save_header_t *header = (const save_header_t *)mapped.data;
+    const save_world_t *world = NULL;
+    const mobj_t *mobjs = NULL;
+    const sobj_t *sobjs = NULL;
+    Uint32 mobj_count = 0, sobj_count = 0;
+#ifdef USE_CONTACT_EVENTS
+    const contact_event_t *contacts = NULL;
+    Uint32 contact_count = 0;
+#endif
+#ifdef USE_BLOCKMAP
+    const blockmap_t *blockmap = NULL;
+#endif
+    Uint32 i, j;
+    int result = 0;
+    for(i=0; i<header->section_count && result == 0; ++i) {
+        if(sections[i].type >= 32 || !(types & (1 << sections[i].type))) {
+            continue;
+        }
+        switch(sections[i].type) {
+            case SAVE_WORLD:
+                world = save_section_data(&mapped, &sections[i], sizeof(save_world_t), 1);
+                if(!world || sections[i].count != 1 || world->tick_rate <= 0) {
+                    result = -1;
+                }
+                break;
+            case SAVE_MOBJS:
+                if(!(mobjs = save_section_data(&mapped, &sections[i], sizeof(mobj_t), MAX_MOBJ_COUNT))) {
+                    result = -1;
+                    break;
+                }
+                mobj_count = sections[i].count;
+                for(j=0; j<mobj_count && result == 0; ++j) {
+                    if(!save_body_check(&mobjs[j].collider, mobjs[j].layer) || !(mobjs[j].mass > 0)) {
+                        result = -1;
+                    }
+                }
+                break;
+            case SAVE_SOBJS:
+                if(!(sobjs = save_section_data(&mapped, &sections[i], sizeof(sobj_t), MAX_SOBJ_COUNT))) {
+                    result = -1;
+                    break;
+                }
+                sobj_count = sections[i].count;
+                for(j=0; j<sobj_count && result == 0; ++j) {
+                    if(!save_body_check(&sobjs[j].collider, sobjs[j].layer)) {
+                        result = -1;
+                    }
+                }
+                break;
+#ifdef USE_CONTACT_EVENTS
+            case SAVE_CONTACTS:
+                if(!(contacts = save_section_data(&mapped, &sections[i], sizeof(contact_event_t), MAX_CONTACT_PAIRS))) {
+                    result = -1;
+                }
+                contact_count = sections[i].count;
+                break;
+#endif
+#ifdef USE_BLOCKMAP
+            // only adopted alongside the sobjs it was built over, after them in the file
+            // one from a build with other blockmap sizes, or that fails the check, is skipped
+            // and tick rebuilds it
+            case SAVE_BLOCKMAP:
+                if(!sobjs) {
+                    break;
+                }
+                blockmap = save_section_data(&mapped, &sections[i], sizeof(blockmap_t), 1);
+                if(blockmap && (sections[i].count != 1 || !blockmap_check(blockmap, sobj_count))) {
+                    blockmap = NULL;
+                }
+                break;
+#endif
+            default: // sections from builds with more features are skipped
+                break;
+        }
+    }
+    if(result < 0) {
+#ifdef VERBOSE
+        printf("%s has a malformed section\n", path);
+#endif
+        file_unmap(&mapped);
+        return -1;
+    }
+
+    if(world) {
+        simulation->tick_rate = world->tick_rate;
+        simulation->frame_rate = world->frame_rate;
+        simulation->gravity = world->gravity;
+        simulation->air_resistance = world->air_resistance;
+        SDL_AtomicSet(&simulation->next_id, world->next_id);
+    }
+    if(mobjs) {
+        SDL_memcpy(simulation->mobjs, mobjs, mobj_count*sizeof(mobj_t));
+        simulation->mobj_count = mobj_count;
+    }
+    if(sobjs) {
+        SDL_memcpy(simulation->sobjs, sobjs, sobj_count*sizeof(sobj_t));
+        simulation->sobj_count = sobj_count;
+        ++simulation->sobj_version;
+        // the file's bounds and normals are the ones add_sobj computed, nothing to redo
+        simulation->sobj_derived_version = simulation->sobj_version;
+    }
+#ifdef USE_CONTACT_EVENTS
+    if(contacts) {
+        SDL_memcpy(simulation->previous_contacts, contacts, contact_count*sizeof(contact_event_t));
+        simulation->previous_contact_count = contact_count;
+        simulation->contact_count = 0;
+    }
+#endif
+#ifdef USE_BLOCKMAP
+    if(blockmap) {
+        SDL_memcpy(&simulation->blockmap, blockmap, sizeof(blockmap_t));
+        simulation->blockmap.version = simulation->sobj_version;
+    }
+#endif
+    file_unmap(&mapped);
+    return 0;
+}
+
+// replaces the simulation's objects and settings with the saved ones
+// the command queue, stats and callbacks are left alone
+int simulation_load(simulation_t *simulation, const char *path) {
+    return save_load_sections(simulation, path, ~0u);
+}
+
+// writes only the sobjs and, with USE_BLOCKMAP, the blockmap over them,
+// built here if needed so loading the level never has to
+int level_save(simulation_t *simulation, const char *path) {
+    simulation_update_sobjs(simulation);
+    return save_write_sections(simulation, path, SAVE_LEVEL_SECTIONS);
+}
+
+// replaces the simulation's sobjs with a level's, leaving mobjs and settings alone
+// works on full save files too
+int level_load(simulation_t *simulation, const char *path) {
+    return save_load_sections(simulation, path, SAVE_LEVEL_SECTIONS);
+}
+#endif
+
+#ifdef USE_SCENE_FILES
+// scene text format, one statement per line, # starts a comment
+//   world [tick_rate N] [gravity X Y] [air_resistance N]
+//   material NAME [bounciness N] [friction_static N] [friction_kinetic N]
+//   shape NAME X Y X Y X Y ...
+//   sobj SHAPE [material NAME] [position X Y] [angle N] [layer N]
+//   mobj SHAPE [material NAME] [position X Y] [velocity X Y] [angular_velocity N] [mass N] [angle N] [layer N]
+// shapes and materials must be declared before they're used, bodies without
+// a material get an all zero one, mobjs get a mass of 1 unless one is given
+// numbers are parsed with strtod so 40 and 40.0 mean the same thing, tick_rate must be
+// a whole number of at least 1 and mass above zero
+// statements build up staged, which only replaces the simulation's world settings and
+// objects once the whole scene has parsed, a bad scene leaves the simulation as it was
+typedef struct scene_loader_s {
+    const char *path;
+    int line;
+    const char *text; // the current line, errors give columns into it
+    char material_names[SCENE_MAX_MATERIALS][SCENE_NAME_LENGTH];
+    material_t materials[SCENE_MAX_MATERIALS];
+    int material_count;
+    char shape_names[SCENE_MAX_SHAPES][SCENE_NAME_LENGTH];
+    collider_t shapes[SCENE_MAX_SHAPES];
+    int shape_count;
+    simulation_t staged;
+} scene_loader_t;
+
+// splits off the next whitespace separated word, NULL at the end of the line
+char *scene_word(char **cursor) {
+    char *word = *cursor;
+    while(*word == ' ' || *word == '\t' || *word == '\r' || *word == '\n') {
+        ++word;
+    }
+    if(*word == 0 || *word == '#') {
+        *cursor = word;
+        return NULL;
+    }
+    char *end = word;
+    while(*end && *end != ' ' && *end != '\t' && *end != '\r' && *end != '\n') {
+        ++end;
+    }
+    *cursor = *end ? end+1 : end;
+    *end = 0;
+    return word;
+}
+
+// word, when there is one, points into the current line and gives the column
+int scene_error(const scene_loader_t *loader, const char *message, const char *word) {
+#ifdef VERBOSE
+    if(word) {
+        printf("%s:%d:%d: %s %s\n", loader->path, loader->line, (int)(word - loader->text) + 1, message, word);
+    } else {
+        printf("%s:%d: %s\n", loader->path, loader->line, message);
+    }
+#endif
+    (void)loader;
+    (void)message;
+    (void)word;
+    return -1;
+}
+
+int scene_number(scene_loader_t *loader, char **cursor, double *value) {
+    char *word = scene_word(cursor), *end;
+    if(!word) {
+        return scene_error(loader, "expected a number", NULL);
+    }
+    *value = strtod(word, &end);
+    if(*end) {
+        return scene_error(loader, "expected a number, got", word);
+    }
+    return 0;
+}
+
+// a number above zero, and a whole one when whole is set
+int scene_positive(scene_loader_t *loader, char **cursor, double *value, bool whole) {
+    char *word = *cursor;
+    if(scene_number(loader, cursor, value) < 0) {
+        return -1;
+    }
+    while(*word == ' ' || *word == '\t' || *word == '\r' || *word == '\n') {
+        ++word;
+    }
+    if(!(*value > 0)) {
+        return scene_error(loader, "expected a number above zero, got", word);
+    }
+    if(whole && (*value < 1 || *value != floor(*value))) {
+        return scene_error(loader, "expected a whole number, got", word);
+    }
+    return 0;
+}
+
+int scene_vector(scene_loader_t *loader, char **cursor, vector_t *value) {
+    if(scene_number(loader, cursor, &value->x) < 0 || scene_number(loader, cursor, &value->y) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+// index of name in a table of names, -1 if it isn't there
+int scene_find(const char (*names)[SCENE_NAME_LENGTH], int count, const char *name) {
+    int i;
+    for(i=0; i<count; ++i) {
+        if(strcmp(names[i], name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// reads a new name into names[count], which must not already be taken
+int scene_name(scene_loader_t *loader, char **cursor, char (*names)[SCENE_NAME_LENGTH], int count, int max) {
+    char *word = scene_word(cursor);
+    if(!word) {
+        return scene_error(loader, "expected a name", NULL);
+    }
+    if(count == max) {
+        return scene_error(loader, "too many declarations for", word);
+    }
+    if(strlen(word) >= SCENE_NAME_LENGTH) {
+        return scene_error(loader, "name too long", word);
+    }
+    if(scene_find((const char (*)[SCENE_NAME_LENGTH])names, count, word) >= 0) {
+        return scene_error(loader, "redeclared", word);
+    }
+    strcpy(names[count], word);
+    return 0;
+}
+
+int scene_world(scene_loader_t *loader, simulation_t *simulation, char *cursor) {
+    char *key;
+    double value;
+    while((key = scene_word(&cursor))) {
+        if(strcmp(key, "gravity") == 0) {
+            if(scene_vector(loader, &cursor, &simulation->gravity) < 0) {
+                return -1;
+            }
+            continue;
+        }
+        if(strcmp(key, "tick_rate") == 0) {
+            if(scene_positive(loader, &cursor, &value, true) < 0) {
+                return -1;
+            }
+            simulation->tick_rate = (int)value;
+            continue;
+        }
+        if(scene_number(loader, &cursor, &value) < 0) {
+            return -1;
+        }
+        if(strcmp(key, "air_resistance") == 0) {
+            simulation->air_resistance = value;
+        } else {
+            return scene_error(loader, "unknown world setting", key);
+        }
+    }
+    return 0;
+}
+
+int scene_material(scene_loader_t *loader, char *cursor) {
+    if(scene_name(loader, &cursor, loader->material_names, loader->material_count, SCENE_MAX_MATERIALS) < 0) {
+        return -1;
+    }
+    material_t *material = &loader->materials[loader->material_count];
+    *material = (material_t){0};
+    char *key;
+    double value;
+    while((key = scene_word(&cursor))) {
+        if(scene_number(loader, &cursor, &value) < 0) {
+            return -1;
+        }
+        if(strcmp(key, "bounciness") == 0) {
+            material->bounciness = value;
+        } else if(strcmp(key, "friction_static") == 0) {
+            material->friction_static = value;
+        } else if(strcmp(key, "friction_kinetic") == 0) {
+            material->friction_kinetic = value;
+        } else {
+            return scene_error(loader, "unknown material property", key);
+        }
+    }
+    ++loader->material_count;
+    return 0;
+}
+
+int scene_shape(scene_loader_t *loader, char *cursor) {
+    if(scene_name(loader, &cursor, loader->shape_names, loader->shape_count, SCENE_MAX_SHAPES) < 0) {
+        return -1;
+    }
+    collider_t *shape = &loader->shapes[loader->shape_count];
+    shape->vertex_count = 0;
+    while(*cursor && *cursor != '#') {
+        if(shape->vertex_count == MAX_COLLIDER_VERTICES) {
+            return scene_error(loader, "too many vertices", NULL);
+        }
+        if(scene_vector(loader, &cursor, &shape->vertices[shape->vertex_count++]) < 0) {
+            return -1;
+        }
+        while(*cursor == ' ' || *cursor == '\t' || *cursor == '\r' || *cursor == '\n') {
+            ++cursor;
+        }
+    }
+    if(shape->vertex_count < 3) {
+        return scene_error(loader, "shapes need at least 3 vertices", NULL);
+    }
+    ++loader->shape_count;
+    return 0;
+}
+
+// reads a body statement into a mobj, sobjs share the layout for the fields they have
+int scene_body(scene_loader_t *loader, char *cursor, mobj_t *body, bool movable) {
+    char *word = scene_word(&cursor);
+    double angle = 0, layer;
+    int index;
+    if(!word) {
+        return scene_error(loader, "expected a shape", NULL);
+    }
+    if((index = scene_find((const char (*)[SCENE_NAME_LENGTH])loader->shape_names, loader->shape_count, word)) < 0) {
+        return scene_error(loader, "unknown shape", word);
+    }
+    *body = (mobj_t){.collider = loader->shapes[index], .mass = 1};
+    while((word = scene_word(&cursor))) {
+        if(strcmp(word, "material") == 0) {
+            if(!(word = scene_word(&cursor))) {
+                return scene_error(loader, "expected a material", NULL);
+            }
+            if((index = scene_find((const char (*)[SCENE_NAME_LENGTH])loader->material_names, loader->material_count, word)) < 0) {
+                return scene_error(loader, "unknown material", word);
+            }
+            body->material = loader->materials[index];
+        } else if(strcmp(word, "position") == 0) {
+            if(scene_vector(loader, &cursor, &body->position) < 0) {
+                return -1;
+            }
+        } else if(strcmp(word, "angle") == 0) {
+            if(scene_number(loader, &cursor, &angle) < 0) {
+                return -1;
+            }
+        } else if(strcmp(word, "layer") == 0) {
+            if(scene_number(loader, &cursor, &layer) < 0) {
+                return -1;
+            }
+            if(layer < 0 || layer > 31 || layer != floor(layer)) {
+                return scene_error(loader, "layer must be a whole number from 0 to 31", NULL);
+            }
+            body->layer = (int)layer;
+        } else if(movable && strcmp(word, "velocity") == 0) {
+            if(scene_vector(loader, &cursor, &body->velocity) < 0) {
+                return -1;
+            }
+        } else if(movable && strcmp(word, "angular_velocity") == 0) {
+            if(scene_number(loader, &cursor, &body->angular_velocity) < 0) {
+                return -1;
+            }
+        } else if(movable && strcmp(word, "mass") == 0) {
+            if(scene_positive(loader, &cursor, &body->mass, false) < 0) {
+                return -1;
+            }
+        } else {
+            return scene_error(loader, movable ? "unknown mobj property" : "unknown sobj property", word);
+        }
+    }
+    body->collider = rotate(body->collider, angle);
+    body->angle = angle;
+    return 0;
+}
+
+// one line of a scene, already stripped of its trailing newline
+int scene_statement(scene_loader_t *loader, simulation_t *simulation, char *cursor) {
+    char *keyword = scene_word(&cursor);
+    mobj_t body;
+    if(!keyword) {
+        return 0;
+    }
+    if(strcmp(keyword, "world") == 0) {
+        return scene_world(loader, simulation, cursor);
+    }
+    if(strcmp(keyword, "material") == 0) {
+        return scene_material(loader, cursor);
+    }
+    if(strcmp(keyword, "shape") == 0) {
+        return scene_shape(loader, cursor);
+    }
+    if(strcmp(keyword, "sobj") == 0) {
+        if(scene_body(loader, cursor, &body, false) < 0) {
+            return -1;
+        }
+        if(simulation->sobj_count == MAX_SOBJ_COUNT) {
+            return scene_error(loader, "too many sobjs", NULL);
+        }
+        simulation_add_sobj(simulation, (sobj_t){
+            .position = body.position,
+            .collider = body.collider,
+            .material = body.material,
+            .layer = body.layer
+        });
+        return 0;
+    }
+    if(strcmp(keyword, "mobj") == 0) {
+        if(scene_body(loader, cursor, &body, true) < 0) {
+            return -1;
+        }
+        if(simulation->mobj_count == MAX_MOBJ_COUNT) {
+            return scene_error(loader, "too many mobjs", NULL);
+        }
+        simulation_add_mobj(simulation, body);
+        return 0;
+    }
+    return scene_error(loader, "unknown statement", keyword);
+}
+
+// parses a scene a line at a time into a staged simulation, then copies the world settings
+// and objects over the simulation's, anything else it has is left alone
+int scene_parse(simulation_t *simulation, FILE *file, const char *path) {
+    char line[SCENE_LINE_LENGTH];
+    int result = 0;
+    if(simulation_sobjs_frozen(simulation)) {
+        return -1;
+    }
+    // the staged simulation and the shape and material tables are too big for some stacks
+    scene_loader_t *loader = SDL_malloc(sizeof(scene_loader_t));
+    if(!loader) {
+#ifdef VERBOSE
+        printf("failed to allocate scene loader\n");
+#endif
+        return -1;
+    }
+    loader->path = path;
+    loader->line = 0;
+    loader->text = line;
+    loader->material_count = 0;
+    loader->shape_count = 0;
+    simulation_t *staged = &loader->staged;
+    simulation_init(staged);
+    staged->tick_rate = simulation->tick_rate;
+    staged->gravity = simulation->gravity;
+    staged->air_resistance = simulation->air_resistance;
+    SDL_AtomicSet(&staged->next_id, SDL_AtomicGet(&simulation->next_id));
+    while(result == 0 && fgets(line, sizeof(line), file)) {
+        ++loader->line;
+        if(!strchr(line, '\n') && !feof(file)) {
+            result = scene_error(loader, "line too long", NULL);
+            break;
+        }
+        result = scene_statement(loader, staged, line);
+    }
+
+    if(result == 0) {
+        simulation->tick_rate = staged->tick_rate;
+        simulation->gravity = staged->gravity;
+        simulation->air_resistance = staged->air_resistance;
+        SDL_AtomicSet(&simulation->next_id, SDL_AtomicGet(&staged->next_id));
+        SDL_memcpy(simulation->mobjs, staged->mobjs, staged->mobj_count*sizeof(mobj_t));
+        simulation->mobj_count = staged->mobj_count;
+        SDL_memcpy(simulation->sobjs, staged->sobjs, staged->sobj_count*sizeof(sobj_t));
+        simulation->sobj_count = staged->sobj_count;
+        ++simulation->sobj_version;
+        // simulation_add_sobj derived every staged sobj already
+        simulation->sobj_derived_version = simulation->sobj_version;
+    }
+    SDL_free(loader);
+    return result;
+}
+
+// loads either a scene text file or a compiled scene, which is a save file
+int scene_load(simulation_t *simulation, const char *path) {
+    char magic[8];
+    FILE *file = fopen(path, "rb");
+    if(!file) {
+#ifdef VERBOSE
+        printf("failed to open %s\n", path);
+#endif
+        return -1;
+    }
+    if(fread(magic, 1, 8, file) == 8 && SDL_memcmp(magic, SAVE_MAGIC, 8) == 0) {
+        fclose(file);
+        return simulation_load(simulation, path);
+    }
+    rewind(file);
+    int result = scene_parse(simulation, file, path);
+    fclose(file);
+    return result;
+}
+
+// parses a scene text file once and writes it back out in the save format,
+// which loads with bounds checks and a copy per section instead of parsing
+int scene_compile(const char *scene_path, const char *output_path) {
+    simulation_t *simulation = SDL_malloc(sizeof(simulation_t));
+    if(!simulation) {
+#ifdef VERBOSE
+        printf("failed to allocate simulation\n");
+#endif
+        return -1;
+    }
+    simulation_init(simulation);
+    int result = scene_load(simulation, scene_path);
+#ifdef USE_BLOCKMAP
+    if(result == 0) {
+        blockmap_build(&simulation->blockmap, simulation->sobjs, simulation->sobj_count, simulation->sobj_version);
+    }
+#endif
+    if(result == 0) {
+        result = simulation_save(simulation, output_path);
+    }
+    SDL_free(simulation);
+    return result;
+}
+#endif
+
+#ifdef USE_REPLAY
+#include <stdio.h>
+
+// file layout, little endian:
+//   replay_header_t
+//   one record per tick that changed anything, each a replay_record_t and its payload
+//   zero padding to 8 bytes, then replay_keyframe_t for every keyframe and a replay_footer_t
+// keyframe payload: Uint32 mobj count, then a mobj record for each
+// delta payload: Uint32 entry count, Uint32 removal count, entries, removals
+//   entry: varint id delta, mask byte, then
+//     a mobj record if mask has REPLAY_SPAWN, which also starts the body's quantized state
+//     otherwise a varint for each REPLAY_FIELD bit set, the change in that quantized field
+//   removal: varint id delta
+// mobj record: Sint32 id, layer and vertex count, then doubles for position, velocity,
+//   angular velocity, angle, mass, bounciness, friction_static, friction_kinetic
+//   and x, y of each used vertex, see replay_put_mobj
+// id deltas are from the previous entry or removal, varints are zigzag encoded LEB128
+// mobjs are matched by id, so players don't need to track the simulation's order
+#define REPLAY_MAGIC "PHYSRPLY"
+#define REPLAY_INDEX_MAGIC "PHYSRIDX"
+#define REPLAY_VERSION 2
+#define REPLAY_FIELDS 6
+#define REPLAY_SPAWN 0x80
+#define REPLAY_MOBJ_SIZE(vertex_count) (3*sizeof(Sint32) + (10 + 2*(vertex_count))*sizeof(double))
+
+typedef enum replay_record_type_e {
+    REPLAY_KEYFRAME = 1,
+    REPLAY_DELTA
+} replay_record_type_t;
+
+typedef struct replay_header_s {
+    char magic[8];
+    Uint32 version;
+    Uint32 collider_vertices; // the recording build's, records with more than this build allows are refused
+    Uint32 tick_rate;
+    Uint32 keyframe_interval;
+    double position_scale, velocity_scale, angle_scale, angular_velocity_scale;
+} replay_header_t;
+
+typedef struct replay_record_s {
+    Uint32 tick;
+    Uint32 type;
+    Uint32 size; // payload bytes after this record
+} replay_record_t;
+
+typedef struct replay_keyframe_s {
+    Uint32 tick;
+    Uint32 reserved;
+    Uint64 offset; // of the keyframe's replay_record_t
+} replay_keyframe_t;
+
+// last thing in the file, a recording that was never stopped has no footer
+typedef struct replay_footer_s {
+    Uint64 records_end, index_offset;
+    Uint32 keyframe_count;
+    Uint32 tick_count;
+    char magic[8];
+} replay_footer_t;
+
+// last recorded quantized x, y, velocity x, velocity y, angle and angular velocity of a body
+typedef struct replay_state_s {
+    Sint64 fields[REPLAY_FIELDS];
+    Uint32 seen; // 1 + the last tick the body was recorded on
+} replay_state_t;
+
+typedef struct replay_buffer_s {
+    Uint8 *data;
+    size_t size, capacity;
+} replay_buffer_t;
+
+typedef struct replay_recorder_s {
+    FILE *file;
+    Uint32 tick;
+    // indexed by id, ids come from next_id so they stay dense
+    replay_state_t *states;
+    int state_capacity;
+    int *live; // ids recorded on the previous tick
+    int live_count, live_capacity;
+    Uint64 offset; // file size once everything encoded so far is written
+    replay_keyframe_t *keyframes;
+    int keyframe_count, keyframe_capacity;
+    replay_buffer_t buffers[REPLAY_BUFFERS];
+    int current, written;
+    SDL_sem *filled, *empty;
+    SDL_Thread *writer;
+    SDL_atomic_t running, failed;
+} replay_recorder_t;
+
+void replay_quantize(const mobj_t *mobj, Sint64 *fields) {
+    fields[0] = llround(mobj->position.x * REPLAY_POSITION_SCALE);
+    fields[1] = llround(mobj->position.y * REPLAY_POSITION_SCALE);
+    fields[2] = llround(mobj->velocity.x * REPLAY_VELOCITY_SCALE);
+    fields[3] = llround(mobj->velocity.y * REPLAY_VELOCITY_SCALE);
+    fields[4] = llround(mobj->angle * REPLAY_ANGLE_SCALE);
+    fields[5] = llround(mobj->angular_velocity * REPLAY_ANGULAR_VELOCITY_SCALE);
+}
+
+// writes REPLAY_MOBJ_SIZE(vertex_count) bytes, field by field so padding never reaches the file
+Uint8 *replay_put_mobj(Uint8 *out, const mobj_t *mobj) {
+    Sint32 ints[3] = {mobj->id, mobj->layer, mobj->collider.vertex_count};
+    double doubles[10] = {
+        mobj->position.x, mobj->position.y, mobj->velocity.x, mobj->velocity.y,
+        mobj->angular_velocity, mobj->angle, mobj->mass,
+        mobj->material.bounciness, mobj->material.friction_static, mobj->material.friction_kinetic
+    };
+    int i;
+    SDL_memcpy(out, ints, sizeof(ints));
+    out += sizeof(ints);
+    SDL_memcpy(out, doubles, sizeof(doubles));
+    out += sizeof(doubles);
+    for(i=0; i<mobj->collider.vertex_count; ++i) {
+        SDL_memcpy(out, &mobj->collider.vertices[i].x, sizeof(double));
+        SDL_memcpy(out + sizeof(double), &mobj->collider.vertices[i].y, sizeof(double));
+        out += 2*sizeof(double);
+    }
+    return out;
+}
+
+Uint8 *replay_put_varint(Uint8 *out, Sint64 value) {
+    Uint64 zigzag = ((Uint64)value << 1) ^ (Uint64)(value >> 63);
+    while(zigzag >= 0x80) {
+        *out++ = (Uint8)(zigzag | 0x80);
+        zigzag >>= 7;
+    }
+    *out++ = (Uint8)zigzag;
+    return out;
+}
+
+// grows an array of size bytes per element to hold at least count
+bool replay_reserve(void **array, int *capacity, int count, size_t size) {
+    if(count <= *capacity) {
+        return true;
+    }
+    int new_capacity = *capacity ? *capacity : 256;
+    while(new_capacity < count) {
+        new_capacity *= 2;
+    }
+    void *grown = SDL_realloc(*array, new_capacity * size);
+    if(!grown) {
+        return false;
+    }
+    SDL_memset((Uint8 *)grown + *capacity*size, 0, (new_capacity - *capacity) * size);
+    *array = grown;
+    *capacity = new_capacity;
+    return true;
+}
+
+int replay_writer(void *data) {
+    replay_recorder_t *recorder = data;
+    replay_buffer_t *buffer;
+    for(;;) {
+        SDL_SemWait(recorder->filled);
+        buffer = &recorder->buffers[recorder->written];
+        if(buffer->size == 0 && !SDL_AtomicGet(&recorder->running)) {
+            return 0;
+        }
+        if(fwrite(buffer->data, 1, buffer->size, recorder->file) != buffer->size) {
+            SDL_AtomicSet(&recorder->failed, 1);
+        }
+        buffer->size = 0;
+        recorder->written = (recorder->written + 1) % REPLAY_BUFFERS;
+        SDL_SemPost(recorder->empty);
+    }
+}
+
+// hands the current buffer to the writer, blocking only if every other buffer is still queued
+void replay_submit(replay_recorder_t *recorder) {
+    if(recorder->buffers[recorder->current].size == 0) {
+        return;
+    }
+    SDL_SemPost(recorder->filled);
+    recorder->current = (recorder->current + 1) % REPLAY_BUFFERS;
+    SDL_SemWait(recorder->empty);
+}
+
+// room for size more bytes in the current buffer
+Uint8 *replay_space(replay_recorder_t *recorder, size_t size) {
+    replay_buffer_t *buffer = &recorder->buffers[recorder->current];
+    if(buffer->size + size > REPLAY_BUFFER_SIZE && buffer->size > 0) {
+        replay_submit(recorder);
+        buffer = &recorder->buffers[recorder->current];
+    }
+    if(buffer->size + size > buffer->capacity) {
+        size_t capacity = buffer->size + size > REPLAY_BUFFER_SIZE ? buffer->size + size : REPLAY_BUFFER_SIZE;
+        Uint8 *data = SDL_realloc(buffer->data, capacity);
+        if(!data) {
+            return NULL;
+        }
+        buffer->data = data;
+        buffer->capacity = capacity;
+    }
+    return buffer->data + buffer->size;
+}
+
+void replay_recorder_free(replay_recorder_t *recorder) {
+    int i;
+    for(i=0; i<REPLAY_BUFFERS; ++i) {
+        SDL_free(recorder->buffers[i].data);
+    }
+    SDL_free(recorder->states);
+    SDL_free(recorder->live);
+    SDL_free(recorder->keyframes);
+    if(recorder->filled) {
+        SDL_DestroySemaphore(recorder->filled);
+    }
+    if(recorder->empty) {
+        SDL_DestroySemaphore(recorder->empty);
+    }
+    fclose(recorder->file);
+}
+
+int replay_recorder_start(replay_recorder_t *recorder, const simulation_t *simulation, const char *path) {
+    *recorder = (replay_recorder_t){0};
+    recorder->file = fopen(path, "wb");
+    if(!recorder->file) {
+#ifdef VERBOSE
+        printf("failed to open replay file %s\n", path);
+#endif
+        return -1;
+    }
+    replay_header_t header = {
+        .version = REPLAY_VERSION,
+        .collider_vertices = MAX_COLLIDER_VERTICES,
+        .tick_rate = simulation->tick_rate,
+        .keyframe_interval = REPLAY_KEYFRAME_INTERVAL,
+        .position_scale = REPLAY_POSITION_SCALE,
+        .velocity_scale = REPLAY_VELOCITY_SCALE,
+        .angle_scale = REPLAY_ANGLE_SCALE,
+        .angular_velocity_scale = REPLAY_ANGULAR_VELOCITY_SCALE
+    };
+    SDL_memcpy(header.magic, REPLAY_MAGIC, 8);
+    recorder->filled = SDL_CreateSemaphore(0);
+    recorder->empty = SDL_CreateSemaphore(REPLAY_BUFFERS-1);
+    if(fwrite(&header, sizeof(header), 1, recorder->file) != 1 || !recorder->filled || !recorder->empty) {
+        replay_recorder_free(recorder);
+        return -1;
+    }
+    recorder->offset = sizeof(header);
+    SDL_AtomicSet(&recorder->running, 1);
+    recorder->writer = SDL_CreateThread(replay_writer, "replay writer", recorder);
+    if(!recorder->writer) {
+        replay_recorder_free(recorder);
+        return -1;
+    }
+    return 0;
+}
+
+void replay_record_keyframe(replay_recorder_t *recorder, const simulation_t *simulation, Uint8 *start) {
+    Uint32 count = simulation->mobj_count;
+    Uint8 *out = start + sizeof(replay_record_t) + sizeof(count);
+    int i, id;
+    for(i=0; i<simulation->mobj_count; ++i) {
+        out = replay_put_mobj(out, &simulation->mobjs[i]);
+        id = simulation->mobjs[i].id;
+        replay_quantize(&simulation->mobjs[i], recorder->states[id].fields);
+        recorder->states[id].seen = recorder->tick+1;
+    }
+    replay_record_t record = {recorder->tick, REPLAY_KEYFRAME, (Uint32)(out - start - sizeof(replay_record_t))};
+    SDL_memcpy(start, &record, sizeof(record));
+    SDL_memcpy(start + sizeof(record), &count, sizeof(count));
+    recorder->buffers[recorder->current].size += out - start;
+}
+
+void replay_record_delta(replay_recorder_t *recorder, const simulation_t *simulation, Uint8 *start) {
+    replay_state_t *state;
+    Sint64 fields[REPLAY_FIELDS];
+    Uint32 counts[2] = {0, 0};
+    Uint8 *out = start + sizeof(replay_record_t) + sizeof(counts), *mask;
+    int i, f, id, previous_id = 0;
+    for(i=0; i<simulation->mobj_count; ++i) {
+        id = simulation->mobjs[i].id;
+        state = &recorder->states[id];
+        replay_quantize(&simulation->mobjs[i], fields);
+        if(state->seen != recorder->tick) {
+            out = replay_put_varint(out, id - previous_id);
+            *out++ = REPLAY_SPAWN;
+            out = replay_put_mobj(out, &simulation->mobjs[i]);
+            SDL_memcpy(state->fields, fields, sizeof(fields));
+            previous_id = id;
+            ++counts[0];
+        } else if(SDL_memcmp(state->fields, fields, sizeof(fields)) != 0) {
+            out = replay_put_varint(out, id - previous_id);
+            mask = out++;
+            *mask = 0;
+            for(f=0; f<REPLAY_FIELDS; ++f) {
+                if(fields[f] != state->fields[f]) {
+                    *mask |= 1 << f;
+                    out = replay_put_varint(out, fields[f] - state->fields[f]);
+                    state->fields[f] = fields[f];
+                }
+            }
+            previous_id = id;
+            ++counts[0];
+        }
+        state->seen = recorder->tick+1;
+    }
+    for(i=0; i<recorder->live_count; ++i) {
+        id = recorder->live[i];
+        if(recorder->states[id].seen != recorder->tick+1) {
+            out = replay_put_varint(out, id - previous_id);
+            previous_id = id;
+            ++counts[1];
+        }
+    }
+    // ticks where nothing moved aren't written at all
+    if(counts[0] == 0 && counts[1] == 0) {
+        return;
+    }
+    // records aren't aligned, varints leave them wherever the last one ended
+    replay_record_t record = {recorder->tick, REPLAY_DELTA, (Uint32)(out - start - sizeof(replay_record_t))};
+    SDL_memcpy(start, &record, sizeof(record));
+    SDL_memcpy(start + sizeof(record), counts, sizeof(counts));
+    recorder->buffers[recorder->current].size += out - start;
+}
+
+// call once after every tick, the first call writes a keyframe
+// encoding happens here, writing to the file happens on the writer thread
+void replay_recorder_tick(replay_recorder_t *recorder, const simulation_t *simulation) {
+    int i, id, max_id = 0;
+    bool keyframe = recorder->tick % REPLAY_KEYFRAME_INTERVAL == 0;
+    // worst case for a delta is every field of every mobj changing, a whole mobj only for
+    // the ones that weren't recorded last tick, and every live one being removed
+    size_t worst = sizeof(replay_record_t) + 2*sizeof(Uint32) + recorder->live_count * 10;
+    for(i=0; i<simulation->mobj_count; ++i) {
+        id = simulation->mobjs[i].id;
+        max_id = id > max_id ? id : max_id;
+        if(keyframe) {
+            worst += REPLAY_MOBJ_SIZE(simulation->mobjs[i].collider.vertex_count);
+        } else if(id >= recorder->state_capacity || recorder->states[id].seen != recorder->tick) {
+            worst += 10 + 1 + REPLAY_MOBJ_SIZE(simulation->mobjs[i].collider.vertex_count);
+        } else {
+            worst += 10 + 1 + REPLAY_FIELDS*10;
+        }
+    }
+    Uint8 *out = replay_space(recorder, worst);
+    if(!out || !replay_reserve((void **)&recorder->states, &recorder->state_capacity, max_id+1, sizeof(replay_state_t))
+       || !replay_reserve((void **)&recorder->live, &recorder->live_capacity, simulation->mobj_count, sizeof(int))
+       || (keyframe && !replay_reserve((void **)&recorder->keyframes, &recorder->keyframe_capacity,
+                                       recorder->keyframe_count+1, sizeof(replay_keyframe_t)))) {
+        SDL_AtomicSet(&recorder->failed, 1);
+        ++recorder->tick;
+        return;
+    }
+    size_t size = recorder->buffers[recorder->current].size;
+    if(keyframe) {
+        recorder->keyframes[recorder->keyframe_count++] = (replay_keyframe_t){recorder->tick, 0, recorder->offset};
+        replay_record_keyframe(recorder, simulation, out);
+    } else {
+        replay_record_delta(recorder, simulation, out);
+    }
+    recorder->offset += recorder->buffers[recorder->current].size - size;
+    for(i=0; i<simulation->mobj_count; ++i) {
+        recorder->live[i] = simulation->mobjs[i].id;
+    }
+    recorder->live_count = simulation->mobj_count;
+    ++recorder->tick;
+}
+
+// flushes everything recorded and closes the file, returns -1 if anything failed to write
+int replay_recorder_stop(replay_recorder_t *recorder) {
+    replay_submit(recorder);
+    SDL_AtomicSet(&recorder->running, 0);
+    SDL_SemPost(recorder->filled);
+    SDL_WaitThread(recorder->writer, NULL);
+    int result = SDL_AtomicGet(&recorder->failed) ? -1 : 0;
+
+    static const Uint8 padding[8] = {0};
+    size_t pad = (8 - recorder->offset % 8) % 8;
+    replay_footer_t footer = {
+        .records_end = recorder->offset,
+        .index_offset = recorder->offset + pad,
+        .keyframe_count = recorder->keyframe_count,
+        .tick_count = recorder->tick
+    };
+    SDL_memcpy(footer.magic, REPLAY_INDEX_MAGIC, 8);
+    if(fwrite(padding, 1, pad, recorder->file) != pad
+       || fwrite(recorder->keyframes, sizeof(replay_keyframe_t), recorder->keyframe_count, recorder->file)
+          != (size_t)recorder->keyframe_count
+       || fwrite(&footer, sizeof(footer), 1, recorder->file) != 1
+       || fflush(recorder->file) != 0) {
+        result = -1;
+    }
+    replay_recorder_free(recorder);
+#ifdef VERBOSE
+    if(result < 0) {
+        printf("failed to write replay\n");
+    }
+#endif
+    return result;
+}
+
+#ifdef USE_MAPPED_FILES
+// bodies are rebuilt from the spawn or keyframe record plus the quantized deltas since,
+// collider holds the vertices as recorded at base_angle and is rotated on output
+typedef struct replay_body_s {
+    mobj_t mobj;
+    double base_angle;
+    Sint64 fields[REPLAY_FIELDS];
+} replay_body_t;
+
+// plays a replay file back from a read only mapping
+// seeking starts from the nearest keyframe at or before the target,
+// so reaching any tick costs at most REPLAY_KEYFRAME_INTERVAL deltas
+typedef struct replay_player_s {
+    mapped_file_t mapped;
+    replay_header_t header;
+    double steps[REPLAY_FIELDS]; // size of one quantization step for each field
+    const replay_keyframe_t *keyframes;
+    replay_keyframe_t *scanned_keyframes; // built by scanning when the footer is missing
+    Uint32 keyframe_count, tick_count;
+    Uint64 end; // where the records stop
+    Uint64 offset; // next record to decode
+    int tick; // tick the bodies are at, -1 before the first
+    replay_body_t *bodies;
+    int body_count, body_capacity;
+    int *slots; // id to index+1 in bodies
+    int slot_capacity;
+} replay_player_t;
+
+// ids past this in a file are treated as corruption rather than grown into
+#define REPLAY_MAX_ID (1 << 26)
+
+bool replay_get_varint(const Uint8 **in, const Uint8 *end, Sint64 *value) {
+    Uint64 zigzag = 0;
+    int shift = 0;
+    while(*in < end && shift < 64) {
+        Uint8 byte = *(*in)++;
+        zigzag |= (Uint64)(byte & 0x7f) << shift;
+        if(!(byte & 0x80)) {
+            *value = (Sint64)(zigzag >> 1) ^ -(Sint64)(zigzag & 1);
+            return true;
+        }
+        shift += 7;
+    }
+    return false;
+}
+
+// reads what replay_put_mobj wrote, false if it runs past end or has too many vertices
+bool replay_get_mobj(const Uint8 **in, const Uint8 *end, mobj_t *mobj) {
+    Sint32 ints[3];
+    double doubles[10];
+    int i;
+    if(end - *in < (long)REPLAY_MOBJ_SIZE(0)) {
+        return false;
+    }
+    SDL_memcpy(ints, *in, sizeof(ints));
+    if(ints[2] < 0 || ints[2] > MAX_COLLIDER_VERTICES || end - *in < (long)REPLAY_MOBJ_SIZE(ints[2])) {
+        return false;
+    }
+    SDL_memcpy(doubles, *in + sizeof(ints), sizeof(doubles));
+    *in += sizeof(ints) + sizeof(doubles);
+    *mobj = (mobj_t){
+        .id = ints[0],
+        .position = {doubles[0], doubles[1]},
+        .velocity = {doubles[2], doubles[3]},
+        .angular_velocity = doubles[4],
+        .angle = doubles[5],
+        .material = {doubles[7], doubles[8], doubles[9]},
+        .mass = doubles[6],
+        .layer = ints[1]
+    };
+    mobj->collider.vertex_count = ints[2];
+    for(i=0; i<ints[2]; ++i) {
+        SDL_memcpy(&mobj->collider.vertices[i].x, *in, sizeof(double));
+        SDL_memcpy(&mobj->collider.vertices[i].y, *in + sizeof(double), sizeof(double));
+        *in += 2*sizeof(double);
+    }
+    return true;
+}
+
+// adds or replaces the body with mobj's id, values are exact until a delta touches them
+bool replay_player_spawn(replay_player_t *player, const mobj_t *mobj) {
+    replay_body_t body;
+    body.mobj = *mobj;
+    int id = body.mobj.id;
+    if(id <= 0 || id >= REPLAY_MAX_ID
+       || !replay_reserve((void **)&player->slots, &player->slot_capacity, id+1, sizeof(int))
+       || !replay_reserve((void **)&player->bodies, &player->body_capacity, player->body_count+1, sizeof(replay_body_t))) {
+        return false;
+    }
+    body.base_angle = body.mobj.angle;
+    body.fields[0] = llround(body.mobj.position.x * player->header.position_scale);
+    body.fields[1] = llround(body.mobj.position.y * player->header.position_scale);
+    body.fields[2] = llround(body.mobj.velocity.x * player->header.velocity_scale);
+    body.fields[3] = llround(body.mobj.velocity.y * player->header.velocity_scale);
+    body.fields[4] = llround(body.mobj.angle * player->header.angle_scale);
+    body.fields[5] = llround(body.mobj.angular_velocity * player->header.angular_velocity_scale);
+    if(!player->slots[id]) {
+        player->slots[id] = ++player->body_count;
+    }
+    player->bodies[player->slots[id]-1] = body;
+    return true;
+}
+
+// the last body takes the removed one's place, like simulation_remove_mobj
+void replay_player_remove(replay_player_t *player, int id) {
+    int index = player->slots[id]-1;
+    player->slots[id] = 0;
+    if(index != --player->body_count) {
+        player->bodies[index] = player->bodies[player->body_count];
+        player->slots[player->bodies[index].mobj.id] = index+1;
+    }
+}
+
+// applies the record at player->offset, returns false if it is malformed
+bool replay_player_decode(replay_player_t *player) {
+    replay_record_t record;
+    const Uint8 *in = player->mapped.data + player->offset, *end;
+    Uint32 counts[2], i, count;
+    Sint64 value;
+    int id = 0, f;
+    Uint8 mask;
+    mobj_t mobj;
+    replay_body_t *body;
+    double *values[REPLAY_FIELDS];
+    if(player->end - player->offset < sizeof(record)) {
+        return false;
+    }
+    SDL_memcpy(&record, in, sizeof(record));
+    in += sizeof(record);
+    if(record.size > player->end - player->offset - sizeof(record)) {
+        return false;
+    }
+    end = in + record.size;
+    player->offset += sizeof(record) + record.size;
+    player->tick = record.tick;
+
+    if(record.type == REPLAY_KEYFRAME) {
+        if(record.size < sizeof(Uint32)) {
+            return false;
+        }
+        SDL_memcpy(&count, in, sizeof(count));
+        in += sizeof(count);
+        for(i=0; i<(Uint32)player->body_count; ++i) {
+            player->slots[player->bodies[i].mobj.id] = 0;
+        }
+        player->body_count = 0;
+        for(i=0; i<count; ++i) {
+            if(!replay_get_mobj(&in, end, &mobj) || !replay_player_spawn(player, &mobj)) {
+                return false;
+            }
+        }
+        return in == end;
+    }
+
+    if(record.type != REPLAY_DELTA || record.size < sizeof(counts)) {
+        return false;
+    }
+    SDL_memcpy(counts, in, sizeof(counts));
+    in += sizeof(counts);
+    for(i=0; i<counts[0]; ++i) {
+        if(!replay_get_varint(&in, end, &value) || in >= end) {
+            return false;
+        }
+        id += (int)value;
+        mask = *in++;
+        if(mask & REPLAY_SPAWN) {
+            if(!replay_get_mobj(&in, end, &mobj) || !replay_player_spawn(player, &mobj)) {
+                return false;
+            }
+            continue;
+        }
+        if(id <= 0 || id >= player->slot_capacity || !player->slots[id]) {
+            return false;
+        }
+        body = &player->bodies[player->slots[id]-1];
+        values[0] = &body->mobj.position.x;
+        values[1] = &body->mobj.position.y;
+        values[2] = &body->mobj.velocity.x;
+        values[3] = &body->mobj.velocity.y;
+        values[4] = &body->mobj.angle;
+        values[5] = &body->mobj.angular_velocity;
+        for(f=0; f<REPLAY_FIELDS; ++f) {
+            if(mask & (1 << f)) {
+                if(!replay_get_varint(&in, end, &value)) {
+                    return false;
+                }
+                body->fields[f] += value;
+                *values[f] = body->fields[f] * player->steps[f];
+            }
+        }
+    }
+    for(i=0; i<counts[1]; ++i) {
+        if(!replay_get_varint(&in, end, &value)) {
+            return false;
+        }
+        id += (int)value;
+        if(id <= 0 || id >= player->slot_capacity || !player->slots[id]) {
+            return false;
+        }
+        replay_player_remove(player, id);
+    }
+    return true;
+}
+
+// walks the records to find the keyframes of a recording that has no footer
+bool replay_player_scan(replay_player_t *player) {
+    replay_record_t record;
+    Uint64 offset = sizeof(replay_header_t);
+    int capacity = 0, count = 0;
+    player->tick_count = 0;
+    while(offset + sizeof(record) <= player->mapped.size) {
+        SDL_memcpy(&record, player->mapped.data + offset, sizeof(record));
+        if(record.size > player->mapped.size - offset - sizeof(record)) {
+            break;
+        }
+        if(record.type == REPLAY_KEYFRAME) {
+            if(!replay_reserve((void **)&player->scanned_keyframes, &capacity, count+1, sizeof(replay_keyframe_t))) {
+                return false;
+            }
+            player->scanned_keyframes[count++] = (replay_keyframe_t){record.tick, 0, offset};
+        }
+        player->tick_count = record.tick+1;
+        offset += sizeof(record) + record.size;
+    }
+    player->keyframes = player->scanned_keyframes;
+    player->keyframe_count = count;
+    player->end = offset;
+    return true;
+}
+
+void replay_player_close(replay_player_t *player) {
+    SDL_free(player->scanned_keyframes);
+    SDL_free(player->bodies);
+    SDL_free(player->slots);
+    file_unmap(&player->mapped);
+}
+
+int replay_player_open(replay_player_t *player, const char *path) {
+    replay_footer_t footer;
+    *player = (replay_player_t){.tick = -1};
+    if(file_map(&player->mapped, path) < 0) {
+#ifdef VERBOSE
+        printf("failed to map %s\n", path);
+#endif
+        return -1;
+    }
+    if(player->mapped.size < sizeof(replay_header_t)) {
+        file_unmap(&player->mapped);
+        return -1;
+    }
+    SDL_memcpy(&player->header, player->mapped.data, sizeof(replay_header_t));
+    if(!host_is_little_endian() || SDL_memcmp(player->header.magic, REPLAY_MAGIC, 8) != 0
+       || player->header.version != REPLAY_VERSION) {
+#ifdef VERBOSE
+        printf("%s is not a replay for this build\n", path);
+#endif
+        file_unmap(&player->mapped);
+        return -1;
+    }
+
+    player->steps[0] = player->steps[1] = 1 / player->header.position_scale;
+    player->steps[2] = player->steps[3] = 1 / player->header.velocity_scale;
+    player->steps[4] = 1 / player->header.angle_scale;
+    player->steps[5] = 1 / player->header.angular_velocity_scale;
+
+    if(player->mapped.size >= sizeof(replay_header_t) + sizeof(footer)) {
+        SDL_memcpy(&footer, player->mapped.data + player->mapped.size - sizeof(footer), sizeof(footer));
+    }
+    if(player->mapped.size >= sizeof(replay_header_t) + sizeof(footer)
+       && SDL_memcmp(footer.magic, REPLAY_INDEX_MAGIC, 8) == 0
+       && footer.index_offset >= sizeof(replay_header_t) && footer.index_offset % 8 == 0
+       && footer.index_offset + (Uint64)footer.keyframe_count*sizeof(replay_keyframe_t) + sizeof(footer) == player->mapped.size) {
+        player->keyframes = (const replay_keyframe_t *)(player->mapped.data + footer.index_offset);
+        player->keyframe_count = footer.keyframe_count;
+        player->tick_count = footer.tick_count;
+        player->end = footer.records_end <= footer.index_offset ? footer.records_end : footer.index_offset;
+    } else if(!replay_player_scan(player)) {
+        replay_player_close(player);
+        return -1;
+    }
+    player->offset = sizeof(replay_header_t);
+    return 0;
+}
+
+// decodes every record up to and including tick from where the player is
+int replay_player_advance(replay_player_t *player, int tick) {
+    replay_record_t record;
+    while(player->end - player->offset >= sizeof(record)) {
+        SDL_memcpy(&record, player->mapped.data + player->offset, sizeof(record));
+        if(record.tick > (Uint32)tick) {
+            break;
+        }
+        if(!replay_player_decode(player)) {
+#ifdef VERBOSE
+            printf("malformed replay record at %llu\n", (unsigned long long)player->offset);
+#endif
+            return -1;
+        }
+    }
+    player->tick = tick;
+    return 0;
+}
+
+// moves the bodies to tick, returns -1 past the end of the recording or on a malformed record
+int replay_player_seek(replay_player_t *player, int tick) {
+    Uint32 low = 0, high = player->keyframe_count, middle;
+    if(tick < 0 || (Uint32)tick >= player->tick_count) {
+        return -1;
+    }
+    // last keyframe at or before tick
+    while(high - low > 1) {
+        middle = (low + high) / 2;
+        if(player->keyframes[middle].tick <= (Uint32)tick) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+    // decoding forward from where the bodies already are is never slower than that keyframe
+    if(player->keyframe_count && player->keyframes[low].tick <= (Uint32)tick
+       && (tick < player->tick || player->tick < (int)player->keyframes[low].tick)) {
+        if(player->keyframes[low].offset < sizeof(replay_header_t) || player->keyframes[low].offset >= player->end) {
+            return -1;
+        }
+        player->offset = player->keyframes[low].offset;
+    } else if(tick < player->tick) {
+        return -1;
+    }
+    return replay_player_advance(player, tick);
+}
+
+// advances one tick, returns false at the end of the recording
+// this is the fast forward path, nothing is rotated or copied out
+bool replay_player_step(replay_player_t *player) {
+    if(player->tick < 0) {
+        return replay_player_seek(player, 0) == 0;
+    }
+    if((Uint32)player->tick+1 >= player->tick_count) {
+        return false;
+    }
+    return replay_player_advance(player, player->tick+1) == 0;
+}
+
+// copies the bodies at the current tick into the simulation's mobjs, for rendering or resuming
+void replay_player_apply(const replay_player_t *player, simulation_t *simulation) {
+    int i;
+    const replay_body_t *body;
+    simulation->mobj_count = player->body_count < MAX_MOBJ_COUNT ? player->body_count : MAX_MOBJ_COUNT;
+    for(i=0; i<simulation->mobj_count; ++i) {
+        body = &player->bodies[i];
+        simulation->mobjs[i] = body->mobj;
+        if(body->mobj.angle != body->base_angle) {
+            simulation->mobjs[i].collider = rotate(body->mobj.collider, body->mobj.angle - body->base_angle);
+        }
+    }
+}
+#endif
+#endif
+
+#ifdef USE_ROLLBACK
+#include <stdio.h>
+
+// everything tick changes or reads back from a mobj, colliders are stored
+// with only their used vertices since tick rotates them every substep
+typedef struct rollback_body_s {
+    int id, vertex_count, layer;
+    vector_t position, velocity;
+    double angular_velocity, angle, mass;
+    material_t material;
+} rollback_body_t;
+
+typedef struct rollback_frame_s {
+    Uint32 frame;
+    bool used;
+    int mobj_count, contact_count;
+    int next_id;
+} rollback_frame_t;
+
+// captures live in one preallocated block, slot i holds frame i % capacity
+// sobjs are not captured, changing them invalidates the ring as far as rollback is concerned
+typedef struct rollback_s {
+    Uint8 *data;
+    size_t slot_size;
+    int capacity;
+} rollback_t;
+
+int rollback_init(rollback_t *rollback, int capacity) {
+    rollback->data = NULL;
+    rollback->capacity = capacity;
+    if(capacity <= 0) {
+#ifdef VERBOSE
+        printf("rollback needs at least one frame, got %d\n", capacity);
+#endif
+        return -1;
+    }
+    rollback->slot_size = sizeof(rollback_frame_t)
+                        + MAX_MOBJ_COUNT * (sizeof(rollback_body_t) + MAX_COLLIDER_VERTICES*sizeof(vector_t));
+#ifdef USE_CONTACT_EVENTS
+    rollback->slot_size += MAX_CONTACT_PAIRS * sizeof(contact_event_t);
+#endif
+    // keeps every slot's frame header aligned
+    rollback->slot_size = (rollback->slot_size + 15) & ~(size_t)15;
+    rollback->data = SDL_malloc(rollback->slot_size * capacity);
+    if(!rollback->data) {
+#ifdef VERBOSE
+        printf("failed to allocate %d rollback frames\n", capacity);
+#endif
+        return -1;
+    }
+    int i;
+    for(i=0; i<capacity; ++i) {
+        ((rollback_frame_t *)(rollback->data + i*rollback->slot_size))->used = false;
+    }
+    return 0;
+}
+
+void rollback_destroy(rollback_t *rollback) {
+    SDL_free(rollback->data);
+    rollback->data = NULL;
+}
+
+// captures the simulation as it is at frame, overwriting frame - capacity
+void rollback_save(rollback_t *rollback, const simulation_t *simulation, Uint32 frame) {
+    Uint8 *slot = rollback->data + (frame % rollback->capacity) * rollback->slot_size;
+    rollback_frame_t *header = (rollback_frame_t *)slot;
+    Uint8 *out = slot + sizeof(rollback_frame_t);
+    const mobj_t *mobj;
+    int i;
+    *header = (rollback_frame_t){
+        .frame = frame,
+        .used = true,
+        .mobj_count = simulation->mobj_count,
+        .next_id = SDL_AtomicGet((SDL_atomic_t *)&simulation->next_id)
+    };
+    for(i=0; i<simulation->mobj_count; ++i) {
+        mobj = &simulation->mobjs[i];
+        *(rollback_body_t *)out = (rollback_body_t){
+            mobj->id, mobj->collider.vertex_count, mobj->layer,
+            mobj->position, mobj->velocity,
+            mobj->angular_velocity, mobj->angle, mobj->mass,
+            mobj->material
+        };
+        out += sizeof(rollback_body_t);
+        SDL_memcpy(out, mobj->collider.vertices, mobj->collider.vertex_count*sizeof(vector_t));
+        out += mobj->collider.vertex_count*sizeof(vector_t);
+    }
+#ifdef USE_CONTACT_EVENTS
+    // decides begin or persist for the next tick's contacts
+    header->contact_count = simulation->previous_contact_count;
+    SDL_memcpy(out, simulation->previous_contacts, simulation->previous_contact_count*sizeof(contact_event_t));
+#endif
+}
+
+// puts the simulation back to how it was at frame, -1 if frame has been overwritten or never saved
+// ticking from there repeats the original run exactly, given the same commands,
+// contact events from the re-simulated ticks are emitted again
+int rollback_restore(const rollback_t *rollback, simulation_t *simulation, Uint32 frame) {
+    const Uint8 *slot = rollback->data + (frame % rollback->capacity) * rollback->slot_size;
+    const rollback_frame_t *header = (const rollback_frame_t *)slot;
+    const Uint8 *in = slot + sizeof(rollback_frame_t);
+    const rollback_body_t *body;
+    mobj_t *mobj;
+    int i;
+    if(!header->used || header->frame != frame) {
+        return -1;
+    }
+    simulation->mobj_count = header->mobj_count;
+    SDL_AtomicSet(&simulation->next_id, header->next_id);
+    for(i=0; i<header->mobj_count; ++i) {
+        body = (const rollback_body_t *)in;
+        mobj = &simulation->mobjs[i];
+        mobj->id = body->id;
+        mobj->position = body->position;
+        mobj->velocity = body->velocity;
+        mobj->angular_velocity = body->angular_velocity;
+        mobj->angle = body->angle;
+        mobj->mass = body->mass;
+        mobj->material = body->material;
+        mobj->layer = body->layer;
+        mobj->collider.vertex_count = body->vertex_count;
+        in += sizeof(rollback_body_t);
+        SDL_memcpy(mobj->collider.vertices, in, body->vertex_count*sizeof(vector_t));
+        in += body->vertex_count*sizeof(vector_t);
+    }
+#ifdef USE_CONTACT_EVENTS
+    simulation->previous_contact_count = header->contact_count;
+    simulation->contact_count = 0;
+    SDL_memcpy(simulation->previous_contacts, in, header->contact_count*sizeof(contact_event_t));
+#endif
+    return 0;
+}
+#endif
+
+#ifdef USE_BATCH
+// steps many independent simulations across a pool of worker threads
+// each worker claims one world at a time and runs all of its ticks back to back,
+// so the world stays in that core's cache for the whole call
+typedef struct batch_s {
+    SDL_Thread *threads[BATCH_MAX_THREADS];
+    int thread_count;
+    SDL_sem *start, *done;
+    SDL_atomic_t next, running;
+    simulation_t *simulations;
+    int simulation_count, ticks;
+    double world_steps_per_second;
+} batch_t;
+
+void batch_run(batch_t *batch) {
+    int i, t;
+    while((i = SDL_AtomicAdd(&batch->next, 1)) < batch->simulation_count) {
+        TRACE_BEGIN(world);
+        for(t=0; t<batch->ticks; ++t) {
+            tick(&batch->simulations[i]);
+        }
+        TRACE_END(world, "batch world");
+    }
+}
+
+int batch_worker(void *data) {
+    batch_t *batch = data;
+    for(;;) {
+        SDL_SemWait(batch->start);
+        if(!SDL_AtomicGet(&batch->running)) {
+            break;
+        }
+        batch_run(batch);
+        SDL_SemPost(batch->done);
+    }
+    return 0;
+}
+
+void batch_destroy(batch_t *batch) {
+    SDL_AtomicSet(&batch->running, 0);
+    int i;
+    for(i=0; i<batch->thread_count; ++i) {
+        SDL_SemPost(batch->start);
+    }
+    for(i=0; i<batch->thread_count; ++i) {
+        SDL_WaitThread(batch->threads[i], NULL);
+    }
+    SDL_DestroySemaphore(batch->start);
+    SDL_DestroySemaphore(batch->done);
+    batch->thread_count = 0;
+}
+
+// thread_count includes the calling thread, 0 uses one thread per cpu
+// on failure everything created so far is torn down again
+int batch_init(batch_t *batch, int thread_count) {
+    if(thread_count <= 0) {
+        thread_count = SDL_GetCPUCount();
+    }
+    if(thread_count > BATCH_MAX_THREADS) {
+        thread_count = BATCH_MAX_THREADS;
+    }
+    batch->thread_count = 0;
+    batch->world_steps_per_second = 0;
+    SDL_AtomicSet(&batch->running, 1);
+    batch->start = SDL_CreateSemaphore(0);
+    batch->done = SDL_CreateSemaphore(0);
+    if(!batch->start || !batch->done) {
+#ifdef VERBOSE
+        printf("batch failed to create semaphores\n");
+        printf("%s\n", SDL_GetError());
+#endif
+        if(batch->start) {
+            SDL_DestroySemaphore(batch->start);
+        }
+        if(batch->done) {
+            SDL_DestroySemaphore(batch->done);
+        }
+        return -1;
+    }
+    int i;
+    for(i=0; i<thread_count-1; ++i) {
+        batch->threads[i] = SDL_CreateThread(batch_worker, "physics batch", batch);
+        if(!batch->threads[i]) {
+#ifdef VERBOSE
+            printf("batch failed to create worker thread\n");
+            printf("%s\n", SDL_GetError());
+#endif
+            // stops the workers already running and frees the semaphores
+            batch_destroy(batch);
+            return -1;
+        }
+        ++batch->thread_count;
+    }
+    return 0;
+}
+
+// advances every simulation by ticks, returns the throughput in world-steps per second
+double batch_tick(batch_t *batch, simulation_t *simulations, int simulation_count, int ticks) {
+    Uint64 start = SDL_GetPerformanceCounter();
+    batch->simulations = simulations;
+    batch->simulation_count = simulation_count;
+    batch->ticks = ticks;
+    SDL_AtomicSet(&batch->next, 0);
 
-double vector_distance_squared(vector_t vec1, vector_t vec2) {
-    return sqr(vec1.x - vec2.x) + sqr(vec1.y - vec2.y);
-}
+    int i;
+    for(i=0; i<batch->thread_count; ++i) {
+        SDL_SemPost(batch->start);
+    }
+    batch_run(batch);
+    for(i=0; i<batch->thread_count; ++i) {
+        SDL_SemWait(batch->done);
+    }
 
-double vector_distance(vector_t vec1, vector_t vec2) {
-    return sqrt(vector_distance_squared(vec1, vec2));
+    double seconds = (double)(SDL_GetPerformanceCounter()-start) / SDL_GetPerformanceFrequency();
+    batch->world_steps_per_second = seconds > 0 ? (double)simulation_count*ticks / seconds : 0;
+    return batch->world_steps_per_second;
 }
+#endif
 
-double vector_magnitude(vector_t vec) {
-    return sqrt(sqr(vec.x) + sqr(vec.y));
+#ifdef USE_PHYSICS_THREAD
+#define SNAPSHOT_FRESH 4
+
+// runs tick() at tick_rate on its own thread and publishes snapshots through a triple buffer
+// the physics thread owns write_index, the render thread owns read_index,
+// and the spare buffer is swapped between them atomically so neither side ever waits
+typedef struct physics_thread_s {
+    simulation_t *simulation;
+    SDL_Thread *thread;
+    SDL_atomic_t running;
+    snapshot_t buffers[3];
+    int write_index, read_index;
+    SDL_atomic_t spare; // index of the spare buffer, | SNAPSHOT_FRESH when it has not been read yet
+} physics_thread_t;
+
+void physics_thread_publish(physics_thread_t *physics) {
+    simulation_snapshot(physics->simulation, &physics->buffers[physics->write_index]);
+    SDL_MemoryBarrierRelease();
+    physics->write_index = SDL_AtomicSet(&physics->spare, physics->write_index | SNAPSHOT_FRESH) & ~SNAPSHOT_FRESH;
 }
 
-vector_t vector_normalize(vector_t vec) {
-    return vector_multiply(vec, 1.0 / vector_magnitude(vec));
+// latest published snapshot, never blocks
+const snapshot_t *physics_thread_acquire(physics_thread_t *physics) {
+    if(SDL_AtomicGet(&physics->spare) & SNAPSHOT_FRESH) {
+        physics->read_index = SDL_AtomicSet(&physics->spare, physics->read_index) & ~SNAPSHOT_FRESH;
+        SDL_MemoryBarrierAcquire();
+    }
+    return &physics->buffers[physics->read_index];
 }
 
-double vector_dot(vector_t vec1, vector_t vec2) {
-    return vec1.x * vec2.x + vec1.y * vec2.y;
+int physics_thread_main(void *data) {
+    physics_thread_t *physics = data;
+    Uint64 frequency = SDL_GetPerformanceFrequency();
+    Uint64 next = SDL_GetPerformanceCounter();
+    Uint64 start;
+    while(SDL_AtomicGet(&physics->running)) {
+        start = SDL_GetPerformanceCounter();
+        tick(physics->simulation);
+        physics->simulation->tick_time = counter_to_ms(SDL_GetPerformanceCounter() - start);
+        physics_thread_publish(physics);
+
+        next += frequency / physics->simulation->tick_rate;
+        if(next < SDL_GetPerformanceCounter()) {
+            next = SDL_GetPerformanceCounter(); // fell behind, don't try to catch up
+        }
+        wait_until(next);
+    }
+#ifdef USE_PERF_COUNTERS
+    perf_close_thread();
+#endif
+    return 0;
 }
 
-double vector_cross_z(vector_t vec1, vector_t vec2) {
-    return (vec1.x*vec2.y) - (vec1.y*vec2.x);
+// tick() must not be called from any other thread until physics_thread_stop
+// sobjs are brought up to date here and frozen until physics_thread_stop, so tick never
+// rewrites them under the render thread, which draws them straight from the simulation
+int physics_thread_start(physics_thread_t *physics, simulation_t *simulation) {
+    simulation_update_sobjs(simulation);
+    simulation->sobjs_frozen = true;
+    physics->simulation = simulation;
+    physics->write_index = 0;
+    physics->read_index = 1;
+    simulation_snapshot(simulation, &physics->buffers[physics->read_index]);
+    SDL_AtomicSet(&physics->spare, 2);
+    SDL_AtomicSet(&physics->running, 1);
+    physics->thread = SDL_CreateThread(physics_thread_main, "physics", physics);
+    if(!physics->thread) {
+#ifdef VERBOSE
+        printf("failed to create physics thread\n");
+        printf("%s\n", SDL_GetError());
+#endif
+        simulation->sobjs_frozen = false;
+        return -1;
+    }
+    return 0;
 }
 
-vector_t vector_proj(vector_t onto, vector_t from) {
-    return vector_multiply(onto, vector_dot(onto, from)
-           / sqr(vector_magnitude(onto)));
+void physics_thread_stop(physics_thread_t *physics) {
+    SDL_AtomicSet(&physics->running, 0);
+    SDL_WaitThread(physics->thread, NULL);
+    physics->simulation->sobjs_frozen = false;
 }
+#endif
 
-// VERTICES ARE COUNTER CLOCKWISE
-typedef struct collider_s {
-    vector_t vertices[MAX_COLLIDER_VERTICES];
-    int vertex_count;
-} collider_t;
+#ifndef PHYSICS_HEADLESS
+// position is the world point at the top left of the screen
+typedef struct camera_s {
+    vector_t position;
+    double zoom;
+} camera_t;
 
-// ensure minimum 3 vertices
-// ensure varargs have a decimal point, (double) cast, or suffix
-// to explicitly tell the compiler they are doubles
-collider_t make_collider(int vertex_count, ...) {
-    collider_t collider;
-    collider.vertex_count = vertex_count;
-    va_list args;
-    va_start(args, vertex_count);
-    int i;
-    for(i=0; i < vertex_count; ++i) {
-        collider.vertices[i] = (vector_t){
-            .x = va_arg(args, double),
-            .y = va_arg(args, double)
-        };
-    }
-    va_end(args);
-    return collider;
+const camera_t default_camera = {
+    .position = {0, 0},
+    .zoom = 1
+};
+
+vector_t camera_to_screen(const camera_t *camera, vector_t point) {
+    return vector_multiply(vector_sub(point, camera->position), camera->zoom);
 }
 
-collider_t rotate(collider_t original, double angle) {
-    collider_t result = {
-        .vertex_count = original.vertex_count
+// world space area covered by a width x height screen
+aabb_t camera_view(const camera_t *camera, int width, int height) {
+    return (aabb_t){
+        camera->position,
+        vector_add(camera->position, (vector_t){width/camera->zoom, height/camera->zoom})
     };
-    int i;
-    if(angle ==0) {
-        for(i=0; i<original.vertex_count; ++i) {
-            result.vertices[i] = original.vertices[i];
-        }
-        return result;
-    }
+}
 
-    angle = 2*M_PI-angle;
-    for(i=0; i<original.vertex_count; ++i) {
-        result.vertices[i].x = original.vertices[i].x * cos(angle) - original.vertices[i].y * sin(angle);
-        result.vertices[i].y = original.vertices[i].x * sin(angle) + original.vertices[i].y * cos(angle);
-    }
+// every frame's edges and markers are collected into one vertex array
+// and submitted with a single SDL_RenderGeometry call
+// the array is kept between frames and only grows, so steady state frames don't allocate
+// sobjs are drawn once into static_cache, which covers half a screen past every edge of the view
+// so the camera can pan without redrawing it, it's redrawn when the view leaves that area,
+// the zoom or output size changes, or simulation->sobj_version changes
+typedef struct render_context_s {
+    SDL_Renderer *renderer;
+    SDL_Vertex *vertices;
+    int vertex_count, vertex_capacity;
+    int width, height;
+    SDL_Texture *static_cache;
+    int static_cache_version, static_cache_width, static_cache_height;
+    camera_t static_cache_camera;
+} render_context_t;
 
-    return result;
+int render_context_init(render_context_t *context, SDL_Renderer *renderer) {
+    context->renderer = renderer;
+    context->static_cache = NULL;
+    context->static_cache_version = -1;
+    context->vertex_count = 0;
+    context->vertex_capacity = (MAX_MOBJ_COUNT+MAX_SOBJ_COUNT) * MAX_COLLIDER_VERTICES * 6;
+    context->vertices = SDL_malloc(context->vertex_capacity * sizeof(SDL_Vertex));
+    if(!context->vertices) {
+#ifdef VERBOSE
+        printf("failed to allocate render vertices\n");
+#endif
+        return -1;
+    }
+    return 0;
 }
 
-typedef struct line_s {
-    vector_t start, end;
-} line_t;
-
-bool lines_collide(line_t l1, line_t l2, vector_t *collision_point) {
-    double uA = ((l2.end.x-l2.start.x)*(l1.start.y-l2.start.y) - (l2.end.y-l2.start.y)*(l1.start.x-l2.start.x))
-              / ((l2.end.y-l2.start.y)*(l1.end.x-l1.start.x) - (l2.end.x-l2.start.x)*(l1.end.y-l1.start.y));
-    double uB = ((l1.end.x-l1.start.x)*(l1.start.y-l2.start.y) - (l1.end.y-l1.start.y)*(l1.start.x-l2.start.x))
-              / ((l2.end.y-l2.start.y)*(l1.end.x-l1.start.x) - (l2.end.x-l2.start.x)*(l1.end.y-l1.start.y));
+// call when the renderer loses its render targets
+void render_context_invalidate(render_context_t *context) {
+    context->static_cache_version = -1;
+}
 
-    if (uA >= 0 && uA <= 1 && uB >= 0 && uB <= 1) {
-        collision_point->x = l1.start.x + (uA * (l1.end.x-l1.start.x));
-        collision_point->y = l1.start.y + (uA * (l1.end.y-l1.start.y));
-        return true;
+void render_context_destroy(render_context_t *context) {
+    if(context->static_cache) {
+        SDL_DestroyTexture(context->static_cache);
+        context->static_cache = NULL;
     }
-    return false;
+    SDL_free(context->vertices);
+    context->vertices = NULL;
+    context->vertex_capacity = 0;
 }
 
-// only use collision_point if function returns true 
-bool collides(collider_t c1, vector_t position1, collider_t c2, 
-                vector_t position2, vector_t *collision_point, line_t *collision_line) {
-    int i, j;
-    line_t line_i, line_j;
-    for(i=0; i<c1.vertex_count; ++i) {
-        line_i.start = vector_add(position1, c1.vertices[i]);
-        line_i.end = vector_add(position1, c1.vertices[i == c1.vertex_count-1 ? 0 : i+1]);
-        for(j=0; j<c2.vertex_count; ++j) {
-            line_j.start = vector_add(position2, c2.vertices[j]);
-            line_j.end = vector_add(position2, c2.vertices[j == c2.vertex_count-1 ? 0 : j+1]);
-            if(lines_collide(line_i, line_j, collision_point)) {
-                *collision_line = line_j;
-                return true;
-            }
+// returns NULL if the array can't grow
+SDL_Vertex *render_reserve(render_context_t *context, int count) {
+    if(context->vertex_count + count > context->vertex_capacity) {
+        int capacity = context->vertex_capacity*2 + count;
+        SDL_Vertex *vertices = SDL_realloc(context->vertices, capacity * sizeof(SDL_Vertex));
+        if(!vertices) {
+            return NULL;
         }
+        context->vertices = vertices;
+        context->vertex_capacity = capacity;
     }
-    return false;
+    context->vertex_count += count;
+    return &context->vertices[context->vertex_count - count];
 }
 
-typedef struct material_s {
-    double bounciness;
-    double friction_static;
-    double friction_kinetic;
-} material_t;
+// corners in order around the quad
+void render_push_quad(render_context_t *context, vector_t a, vector_t b, vector_t c, vector_t d, SDL_Color color) {
+    SDL_Vertex *vertices = render_reserve(context, 6);
+    if(!vertices) {
+        return;
+    }
+    vector_t corners[6] = {a, b, c, a, c, d};
+    int i;
+    for(i=0; i<6; ++i) {
+        vertices[i] = (SDL_Vertex){
+            .position = {(float)corners[i].x, (float)corners[i].y},
+            .color = color
+        };
+    }
+}
 
-typedef struct sobj_s {
-    vector_t position;
-    collider_t collider;
-    material_t material;
-} sobj_t;
+// one pixel wide, like SDL_RenderDrawLine
+void render_push_line(render_context_t *context, line_t line, SDL_Color color) {
+    vector_t direction = vector_sub(line.end, line.start);
+    double length = vector_magnitude(direction);
+    if(length == 0) {
+        return;
+    }
+    vector_t offset = {-direction.y*0.5/length, direction.x*0.5/length};
+    render_push_quad(context,
+        vector_add(line.start, offset), vector_add(line.end, offset),
+        vector_sub(line.end, offset), vector_sub(line.start, offset),
+        color
+    );
+}
 
-typedef struct mobj_s {
-    vector_t position, velocity;
-    double angular_velocity;
-    collider_t collider;
-    material_t material;
-    double mass;
-} mobj_t;
+void render_push_rect(render_context_t *context, double x, double y, double w, double h, SDL_Color color) {
+    render_push_quad(context,
+        (vector_t){x, y}, (vector_t){x+w, y},
+        (vector_t){x+w, y+h}, (vector_t){x, y+h},
+        color
+    );
+}
 
-void mobj_apply_torque(mobj_t *mobj, double torque) {
-    mobj->angular_velocity += torque/mobj->mass;
+void render_flush(render_context_t *context) {
+    if(context->vertex_count > 0) {
+        SDL_RenderGeometry(context->renderer, NULL, context->vertices, context->vertex_count, NULL, 0);
+    }
+    context->vertex_count = 0;
 }
 
-void mobj_apply_force(mobj_t *mobj, vector_t force, vector_t position) {
-    if(force.x == 0 && force.y == 0) {
-        return;
+void render_obj(render_context_t *context, const camera_t *camera, vector_t position, const collider_t *c) {
+    const SDL_Color white = {255, 255, 255, 255};
+    int i;
+    vector_t first = camera_to_screen(camera, vector_add(position, c->vertices[0]));
+    vector_t start = first, end;
+    for(i=0; i<c->vertex_count; ++i) {
+        end = i == c->vertex_count-1 ? first : camera_to_screen(camera, vector_add(position, c->vertices[i+1]));
+        render_push_line(context, (line_t){start, end}, white);
+        start = end;
     }
-    mobj->velocity = vector_add(mobj->velocity, vector_multiply(force, 1.0/mobj->mass));
-    vector_t cg_dist = vector_sub(mobj->position, position);
-    vector_t projection = vector_proj(force, cg_dist);
-    double distance = vector_distance(cg_dist, projection);
-    char direction = vector_cross_z(cg_dist, projection) > 0 ? 1 : -1;
-    mobj_apply_torque(mobj, direction*distance/M_PI/180/6);
+#ifdef DEBUG_SHOW_CG
+    vector_t cg = camera_to_screen(camera, position);
+    render_push_rect(context, cg.x-1, cg.y-1, 4, 4, (SDL_Color){255, 0, 0, 255});
+#endif
 }
 
-typedef struct simulation_s {
-    int tick_rate;
-    sobj_t sobjs[MAX_SOBJ_COUNT];
-    int sobj_count;
-    mobj_t mobjs[MAX_MOBJ_COUNT];
-    int mobj_count;
-    vector_t gravity;
-    double air_resistance;
-} simulation_t;
+// only sobjs whose cached bounds overlap view are drawn, found through the blockmap when it's current
+void render_sobjs(simulation_t *simulation, render_context_t *context, const camera_t *camera, aabb_t view) {
+    int i, candidates[MAX_SOBJ_COUNT];
+    int count = simulation_sobjs_near(simulation, view, candidates);
+    for(i=0; i<count; ++i) {
+        render_obj(context, camera, simulation->sobjs[candidates[i]].position, &simulation->sobjs[candidates[i]].collider);
+    }
+}
 
-const simulation_t default_simulation = {
-    .tick_rate = 60,
-    .sobj_count = 0,
-    .mobj_count = 0,
-    .gravity = {0, 0.098},
-    .air_resistance = 0
-};
+void render_mobj(render_context_t *context, const camera_t *camera, aabb_t view, aabb_t bounds,
+                 vector_t position, const collider_t *collider) {
+    if(aabbs_overlap(bounds, view)) {
+        render_obj(context, camera, position, collider);
+    }
+}
 
-void simulation_add_mobj(simulation_t *simulation, mobj_t mobj) {
-#ifdef CATCH_OBJECT_OVERFLOW
-    if(simulation->mobj_count == MAX_MOBJ_COUNT) {
-        return;
+// returns false if the cache can't be used and sobjs must be drawn directly
+bool render_update_static_cache(simulation_t *simulation, render_context_t *context, const camera_t *camera) {
+    if(!SDL_RenderTargetSupported(context->renderer)) {
+        return false;
+    }
+    int width = context->width*2, height = context->height*2;
+    camera_t *cache_camera = &context->static_cache_camera;
+    aabb_t view = camera_view(camera, context->width, context->height);
+    aabb_t cached = camera_view(cache_camera, width, height);
+    if(context->static_cache && context->static_cache_version == simulation->sobj_version
+       && context->static_cache_width == width && context->static_cache_height == height
+       && cache_camera->zoom == camera->zoom
+       && view.min.x >= cached.min.x && view.min.y >= cached.min.y
+       && view.max.x <= cached.max.x && view.max.y <= cached.max.y) {
+        return true;
     }
+
+    if(!context->static_cache || context->static_cache_width != width || context->static_cache_height != height) {
+        if(context->static_cache) {
+            SDL_DestroyTexture(context->static_cache);
+        }
+        context->static_cache = SDL_CreateTexture(context->renderer, SDL_PIXELFORMAT_RGBA8888,
+                                                  SDL_TEXTUREACCESS_TARGET, width, height);
+        if(!context->static_cache) {
+#ifdef VERBOSE
+            printf("failed to create static render cache\n");
+            printf("%s\n", SDL_GetError());
 #endif
-    simulation->mobjs[simulation->mobj_count++] = mobj;
+            return false;
+        }
+        SDL_SetTextureBlendMode(context->static_cache, SDL_BLENDMODE_BLEND);
+        context->static_cache_width = width;
+        context->static_cache_height = height;
+    }
+
+    *cache_camera = (camera_t){
+        vector_sub(camera->position, (vector_t){context->width/2/camera->zoom, context->height/2/camera->zoom}),
+        camera->zoom
+    };
+    SDL_SetRenderTarget(context->renderer, context->static_cache);
+    SDL_SetRenderDrawColor(context->renderer, 0, 0, 0, 0);
+    SDL_RenderClear(context->renderer);
+    render_sobjs(simulation, context, cache_camera, camera_view(cache_camera, width, height));
+    render_flush(context);
+    SDL_SetRenderTarget(context->renderer, NULL);
+    context->static_cache_version = simulation->sobj_version;
+    return true;
 }
 
-void simulation_add_sobj(simulation_t *simulation, sobj_t sobj) {
-#ifdef CATCH_OBJECT_OVERFLOW
-    if(simulation->sobj_count == MAX_SOBJ_COUNT) {
-        return;
+void render_static(simulation_t *simulation, render_context_t *context, const camera_t *camera) {
+    if(render_update_static_cache(simulation, context, camera)) {
+        vector_t offset = camera_to_screen(camera, context->static_cache_camera.position);
+        SDL_FRect destination = {
+            (float)offset.x, (float)offset.y,
+            (float)context->static_cache_width, (float)context->static_cache_height
+        };
+        SDL_RenderCopyF(context->renderer, context->static_cache, NULL, &destination);
+    } else {
+        render_sobjs(simulation, context, camera, camera_view(camera, context->width, context->height));
     }
-#endif
-    simulation->sobjs[simulation->sobj_count++] = sobj;
 }
 
 #ifdef DEBUG_SHOW_LAST_COLLISION
-line_t collision_line;
-line_t debug_normal_force;
+void render_last_collision(render_context_t *context, const camera_t *camera, line_t collision_line, line_t normal_force) {
+    collision_line = (line_t){camera_to_screen(camera, collision_line.start), camera_to_screen(camera, collision_line.end)};
+    normal_force = (line_t){camera_to_screen(camera, normal_force.start), camera_to_screen(camera, normal_force.end)};
+    render_push_line(context, collision_line, (SDL_Color){255, 0, 0, 255});
+    render_push_rect(context, collision_line.start.x-1, collision_line.start.y-1, 4, 4, (SDL_Color){255, 0, 0, 255});
+    render_push_line(context, normal_force, (SDL_Color){0, 255, 0, 255});
+}
 #endif
 
-void tick(simulation_t *simulation) {
-    int i, j, step;
-    mobj_t *mobj, *mobj_other;
-    sobj_t *sobj_other;
-    vector_t old_position, collision_point, normal_vector, normal_force;
-    #ifndef DEBUG_SHOW_LAST_COLLISION
-    line_t collision_line;
-    #endif
-    double impact_speed;
-    collider_t old_collider;
-    bool collided;
-    for(step=0; step < SIMULATION_STEPS; ++step) for(i=0; i<simulation->mobj_count; ++i) {
-        mobj = &simulation->mobjs[i];
-        mobj->velocity = vector_add(mobj->velocity, vector_multiply(simulation->gravity, 1.0/SIMULATION_STEPS));
-        collided = false;
-        old_position = mobj->position;
-        old_collider = mobj->collider;
-        mobj->position = vector_add(mobj->position, vector_multiply(mobj->velocity, 1.0/SIMULATION_STEPS));
-        mobj->collider = rotate(mobj->collider, mobj->angular_velocity/SIMULATION_STEPS);
-        for(j=0; j<simulation->mobj_count; ++j) {
-            if(i==j) continue;
-            mobj_other = &simulation->mobjs[j];
-            if(collides(mobj->collider, mobj->position, mobj_other->collider,
-                        mobj_other->position, &collision_point, &collision_line))
-            {
-                collided = true;
-                mobj->position = old_position;
-                mobj->collider = old_collider;
-                mobj->velocity = zero_vector;
-                mobj_other->velocity = zero_vector;
-                // TODO two mobjs colliding
-                break;
-            }
-        }
-        for(j=0; j<simulation->sobj_count; ++j) {
-            sobj_other = &simulation->sobjs[j];
-            if(collides(mobj->collider, mobj->position, sobj_other->collider,
-                        sobj_other->position, &collision_point, &collision_line))
-            {
-                collided = true;
-                normal_vector = vector_normalize((vector_t) {
-                    .x = collision_line.start.y-collision_line.end.y, 
-                    .y = collision_line.end.x-collision_line.start.x
-                });
-                // mobj->position = old_position;
-                // mobj->collider = old_collider;
-                impact_speed = vector_magnitude(mobj->velocity);
-                normal_force = vector_multiply( // TODO ADD ANGULAR VELOCITY TO THIS
-                    normal_vector,
-                    mobj->mass * vector_magnitude(vector_proj(normal_vector, mobj->velocity))
-                );
-#ifdef DEBUG_SHOW_LAST_COLLISION
-                debug_normal_force = (line_t){collision_point, vector_add(collision_point, normal_force)};
-#endif
-                mobj_apply_force(
-                    mobj,
-                    normal_force,
-                    collision_point
-                );
-                // bounciness force
-                mobj_apply_force(
-                    mobj,
-                    vector_multiply(
-                        normal_vector,
-                        impact_speed * mobj->mass * mobj->material.bounciness * sobj_other->material.bounciness
-                    ),
-                    collision_point
-                );
-                break;
-            }
+#ifdef DEBUG_CAPTURE_TICKS
+// older ticks are drawn dimmer
+void render_debug_capture(const debug_capture_t *capture, render_context_t *context, const camera_t *camera) {
+    const debug_frame_t *frame;
+    const debug_contact_t *contact;
+    vector_t point;
+    int age, i;
+    Uint8 alpha;
+    for(age=DEBUG_CAPTURE_TICKS-1; age>=0; --age) {
+        frame = &capture->frames[(capture->frame - age + DEBUG_CAPTURE_TICKS) % DEBUG_CAPTURE_TICKS];
+        alpha = 255 - age*200/DEBUG_CAPTURE_TICKS;
+        for(i=0; i<frame->contact_count; ++i) {
+            contact = &frame->contacts[i];
+            point = camera_to_screen(camera, contact->point);
+            render_push_line(context, (line_t){
+                camera_to_screen(camera, contact->edge.start), camera_to_screen(camera, contact->edge.end)
+            }, (SDL_Color){255, 128, 0, alpha});
+            render_push_rect(context, point.x-1, point.y-1, 3, 3, (SDL_Color){255, 128, 0, alpha});
+            render_push_line(context, (line_t){
+                point, camera_to_screen(camera, contact->normal_force.end)
+            }, (SDL_Color){0, 255, 128, alpha});
         }
     }
 }
+#endif
 
-void render_line_t(SDL_Renderer *renderer, line_t line) {
-    SDL_RenderDrawLine(renderer, line.start.x, line.start.y, line.end.x, line.end.y);
+// returns the world space area on screen
+aabb_t render_begin(simulation_t *simulation, render_context_t *context, const camera_t *camera) {
+    context->vertex_count = 0;
+    if(SDL_GetRendererOutputSize(context->renderer, &context->width, &context->height) < 0) {
+        context->width = context->height = 0;
+    }
+    SDL_SetRenderDrawBlendMode(context->renderer, SDL_BLENDMODE_BLEND);
+    SDL_SetRenderDrawColor(context->renderer, 20, 20, 20, 255);
+    SDL_RenderClear(context->renderer);
+    render_static(simulation, context, camera);
+    return camera_view(camera, context->width, context->height);
 }
 
-void render_rect(SDL_Renderer *renderer, double x, double y, double w, double h) {
-    SDL_Rect rect = {(int)x, (int)y, (int)w, (int)h};
-    SDL_RenderFillRect(renderer, &rect);
-}
+// draws the live simulation, only from the thread calling tick()
+void render_simulation(simulation_t *simulation, render_context_t *context, const camera_t *camera) {
+    aabb_t view = render_begin(simulation, context, camera);
 
-void render_obj(SDL_Renderer *renderer, vector_t position, collider_t c) {
-    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
     int i;
-    for(i=0; i<c.vertex_count-1; ++i) {
-        SDL_RenderDrawLine(
-            renderer,
-            c.vertices[i].x+position.x, c.vertices[i].y+position.y,
-            c.vertices[i+1].x+position.x, c.vertices[i+1].y+position.y
-        );
+    for(i=0; i<simulation->mobj_count; ++i) {
+        render_mobj(context, camera, view, collider_bounds(&simulation->mobjs[i].collider, simulation->mobjs[i].position),
+                    simulation->mobjs[i].position, &simulation->mobjs[i].collider);
     }
-    SDL_RenderDrawLine(
-        renderer,
-        c.vertices[c.vertex_count-1].x+position.x, c.vertices[c.vertex_count-1].y+position.y,
-        c.vertices[0].x+position.x, c.vertices[0].y+position.y
-    );
-#ifdef DEBUG_SHOW_CG
-    SDL_SetRenderDrawColor(renderer, 255, 0, 0, 255);
-    render_rect(renderer, position.x-1, position.y-1, 4, 4);
+#ifdef DEBUG_CAPTURE_TICKS
+    render_debug_capture(&simulation->debug_capture, context, camera);
 #endif
+#ifdef DEBUG_SHOW_LAST_COLLISION
+    render_last_collision(context, camera, simulation->debug_collision_line, simulation->debug_normal_force);
+#endif
+    render_flush(context);
 }
 
+// the original entry point, draws with the default camera through a context kept
+// between calls, passing a different renderer releases the context made for the last one
 void render(simulation_t *simulation, SDL_Renderer *renderer) {
-    SDL_SetRenderDrawColor(renderer, 20, 20, 20, 255);
-    SDL_RenderClear(renderer);
+    static render_context_t context;
+    if(context.renderer != renderer) {
+        if(context.renderer) {
+            render_context_destroy(&context);
+        }
+        if(render_context_init(&context, renderer) < 0) {
+            context.renderer = NULL;
+            return;
+        }
+    }
+    render_simulation(simulation, &context, &default_camera);
+}
+
+// draws mobjs from a snapshot instead of the live simulation
+// sobjs are read from the simulation, physics_thread_start freezes them while its thread runs
+void render_snapshot(simulation_t *simulation, const snapshot_t *snapshot, render_context_t *context, const camera_t *camera) {
+    aabb_t view = render_begin(simulation, context, camera);
 
     int i;
-    for(i=0; i<simulation->mobj_count; ++i) {
-        render_obj(renderer, simulation->mobjs[i].position, simulation->mobjs[i].collider);
+    for(i=0; i<snapshot->mobj_count; ++i) {
+        render_mobj(context, camera, view, snapshot->bounds[i], snapshot->positions[i], &snapshot->colliders[i]);
     }
-    for(i=0; i<simulation->sobj_count; ++i) {
-        render_obj(renderer, simulation->sobjs[i].position, simulation->sobjs[i].collider);
-    }
-
+#ifdef DEBUG_CAPTURE_TICKS
+    render_debug_capture(&snapshot->debug_capture, context, camera);
+#endif
 #ifdef DEBUG_SHOW_LAST_COLLISION
-    SDL_SetRenderDrawColor(renderer, 255, 0, 0, 255);
-    render_line_t(renderer, collision_line);
-    render_rect(renderer, collision_line.start.x-1, collision_line.start.y-1, 4, 4);
-    SDL_SetRenderDrawColor(renderer, 0, 255, 0, 255);
-    render_line_t(renderer, debug_normal_force);
+    render_last_collision(context, camera, snapshot->debug_collision_line, snapshot->debug_normal_force);
 #endif
+    render_flush(context);
 }
 
 int begin_loop(simulation_t *simulation, int windowWidth, int windowHeight, Uint32 flags) {
@@ -423,7 +4868,11 @@ int begin_loop(simulation_t *simulation, int windowWidth, int windowHeight, Uint
         return -1;
     }
 
+#ifdef USE_VSYNC
+    SDL_Renderer *renderer = SDL_CreateRenderer(window, 0, SDL_RENDERER_PRESENTVSYNC);
+#else
     SDL_Renderer *renderer = SDL_CreateRenderer(window, 0, 0);
+#endif
     if(!renderer) {
 #ifdef VERBOSE
         printf("SDL2 failed to create a renderer\n");
@@ -432,10 +4881,40 @@ int begin_loop(simulation_t *simulation, int windowWidth, int windowHeight, Uint
         return -1;
     }
 
+    render_context_t context;
+    if(render_context_init(&context, renderer) < 0) {
+        return -1;
+    }
+
+#ifdef USE_PHYSICS_THREAD
+    physics_thread_t *physics = SDL_malloc(sizeof(physics_thread_t));
+    if(!physics || physics_thread_start(physics, simulation) < 0) {
+        return -1;
+    }
+#endif
+
+    // previous and current are the last two physics states, render draws between them
+    snapshot_t *frames = SDL_malloc(3*sizeof(snapshot_t));
+    if(!frames) {
+        return -1;
+    }
+    snapshot_t *previous = &frames[0], *current = &frames[1], *interpolated = &frames[2], *swap;
+    simulation_snapshot(simulation, current);
+    *previous = *current;
+    double alpha;
+    Uint64 start = SDL_GetPerformanceCounter();
+#ifndef USE_VSYNC
+    Uint64 next_frame = start;
+#endif
+#ifndef USE_PHYSICS_THREAD
+    // fixed dt, the accumulator holds real time not yet simulated, in performance counter units
+    Uint64 last = start, accumulator = 0, tick_length, tick_start;
+    int ticks;
+#endif
+
     bool running = true;
-    clock_t start, stop;
     while(running) {
-        start = clock();
+        start = SDL_GetPerformanceCounter();
 
         SDL_Event e;
         while(SDL_PollEvent(&e) > 0) {
@@ -443,24 +4922,68 @@ int begin_loop(simulation_t *simulation, int windowWidth, int windowHeight, Uint
                 case SDL_QUIT:
                     running = false;
                     break;
+                case SDL_RENDER_TARGETS_RESET:
+                case SDL_RENDER_DEVICE_RESET:
+                    render_context_invalidate(&context);
+                    break;
             }
         }
 
-        tick(simulation);
-        render(simulation, renderer);
+#ifdef USE_PHYSICS_THREAD
+        const snapshot_t *latest = physics_thread_acquire(physics);
+        if(latest->time != current->time) {
+            swap = previous; previous = current; current = swap;
+            *current = *latest;
+        }
+        // one tick behind, the time between the last two publishes is the tick length
+        alpha = current->time > previous->time
+              ? (double)(SDL_GetPerformanceCounter() - current->time) / (current->time - previous->time)
+              : 1;
+        alpha = alpha > 1 ? 1 : alpha;
+#else
+        tick_length = SDL_GetPerformanceFrequency() / simulation->tick_rate;
+        accumulator += start - last;
+        last = start;
+        for(ticks=0; accumulator >= tick_length; ++ticks) {
+            if(ticks == MAX_TICKS_PER_FRAME) {
+                accumulator %= tick_length;
+                break;
+            }
+            tick_start = SDL_GetPerformanceCounter();
+            tick(simulation);
+            simulation->tick_time = counter_to_ms(SDL_GetPerformanceCounter() - tick_start);
+            swap = previous; previous = current; current = swap;
+            simulation_snapshot(simulation, current);
+            accumulator -= tick_length;
+        }
+        alpha = (double)accumulator / tick_length;
+#endif
+        snapshot_interpolate(previous, current, alpha, interpolated);
+        render_snapshot(simulation, interpolated, &context, &default_camera);
 
         SDL_RenderPresent(renderer);
 
-        stop = clock();
-        int delay_time = 1000/simulation->tick_rate - (stop-start);
-        if(delay_time > 0) {
-            SDL_Delay(delay_time);
+#ifndef USE_VSYNC
+        next_frame += SDL_GetPerformanceFrequency() / (simulation->frame_rate > 0 ? simulation->frame_rate : simulation->tick_rate);
+        if(next_frame < SDL_GetPerformanceCounter()) {
+            next_frame = SDL_GetPerformanceCounter();
         }
+        wait_until(next_frame);
+#endif
+        simulation->frame_time = counter_to_ms(SDL_GetPerformanceCounter() - start);
     }
 
+    SDL_free(frames);
+#ifdef USE_PHYSICS_THREAD
+    physics_thread_stop(physics);
+    SDL_free(physics);
+#endif
+
+    render_context_destroy(&context);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     SDL_Quit();
 
     return 0;
-}
\ No newline at end of file
+}
+#endif